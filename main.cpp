@@ -1,8 +1,46 @@
 #include <iostream>
+#include <fstream>
+#include <sstream>
 #include <vector>
 #include <chrono>
 #include <stdexcept>
 #include <string>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <filesystem>
+#include <map>
+#include <set>
+#include <random>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <queue>
+#include <functional>
+#include <exception>
+#include <future>
+#include <new>
+
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sched.h>
+#include <pthread.h>
+#include <linux/futex.h>
+#include <climits>
+#include <csignal>
 
 #define GLEW_STATIC
 #include <GL/glew.h>
@@ -17,6 +55,25 @@
 const int SCREEN_WIDTH = 1024;
 const int SCREEN_HEIGHT = 768;
 
+// Sizes and scales that both the shaders and the buffers made for them depend on. They are
+// only defined here: shaderPreambleSource declares them in GLSL for the shaders.
+const int MAX_DEPTH = 8;                               // path vertices at most; glass needs several
+const GLuint RADIANCE_CACHE_ENTRIES = 1 << 20;         // slots of the radiance cache
+const float RADIANCE_CACHE_SCALE = 1024.0f;            // fixed point of its atomic sums
+const GLuint RADIANCE_CACHE_MAX_PASS_SAMPLES = 1024;   // samples a slot takes per pass
+const GLuint PHOTON_GRID_CELLS = 1 << 18;              // hash cells of the caustic photon map
+const GLuint GUIDE_CELLS = 16384;                      // hash cells of the path guiding distributions
+const GLuint GUIDE_PHI_BINS = 16, GUIDE_COS_BINS = 8, GUIDE_BINS = GUIDE_PHI_BINS * GUIDE_COS_BINS; // direction bins per cell
+
+const std::string shaderPreambleSource = "#version 430 core\n"
+    "const int MAX_DEPTH = " + std::to_string(MAX_DEPTH) + ";\n"
+    "const uint CACHE_ENTRIES = " + std::to_string(RADIANCE_CACHE_ENTRIES) + "u;\n"
+    "const float CACHE_SCALE = " + std::to_string(RADIANCE_CACHE_SCALE) + ";\n"
+    "const uint CACHE_MAX_PASS_SAMPLES = " + std::to_string(RADIANCE_CACHE_MAX_PASS_SAMPLES) + "u;\n"
+    "const uint PHOTON_GRID_CELLS = " + std::to_string(PHOTON_GRID_CELLS) + "u;\n"
+    "const uint GUIDE_CELLS = " + std::to_string(GUIDE_CELLS) + "u;\n"
+    "const uint GUIDE_PHI_BINS = " + std::to_string(GUIDE_PHI_BINS) + "u, GUIDE_COS_BINS = " + std::to_string(GUIDE_COS_BINS) + "u, GUIDE_BINS = " + std::to_string(GUIDE_BINS) + "u;\n";
+
 
 // --- SHADERS (HEAVILY REVISED FRAGMENT SHADER) ---
 
@@ -24,22 +81,46 @@ const char* vertexShaderSource = R"(
 #version 430 core
 layout (location = 0) in vec2 aPos;
 out vec2 TexCoords;
+out ViewData { flat int ViewIndex; }; // the instance; the geometry shader also routes it to a layer
 void main() {
     TexCoords = aPos;
+    ViewIndex = gl_InstanceID;
     gl_Position = vec4(aPos.x * 2.0 - 1.0, aPos.y * 2.0 - 1.0, 0.0, 1.0);
 }
 )";
 
-const char* fragmentShaderSource = R"(
+// Routes instance i of the quad to layer i of the render target, so one instanced draw
+// renders every view of a batch into its own slice of a texture array. Only the multi-view
+// program has this stage; single views skip its cost.
+const char* viewGeometryShaderSource = R"(
 #version 430 core
-out vec4 FragColor;
-in vec2 TexCoords;
+layout (triangles) in;
+layout (triangle_strip, max_vertices = 3) out;
+in ViewData { flat int ViewIndex; } vertices[];
+out ViewData { flat int ViewIndex; };
+void main() {
+    for (int i = 0; i < 3; ++i) {
+        gl_Position = gl_in[i].gl_Position;
+        gl_Layer = vertices[0].ViewIndex;
+        ViewIndex = vertices[0].ViewIndex;
+        EmitVertex();
+    }
+    EndPrimitive();
+}
+)";
+
+// Shared by the path tracing fragment shader and the ReSTIR compute passes: scene data,
+// random numbers, intersection, camera rays, light sampling and the path tracer itself.
+const std::string tracerCommonSource = shaderPreambleSource + R"(
 
 // --- Uniforms ---
-uniform vec3 u_camera_pos;
-uniform mat4 u_camera_view;
-uniform float u_time;
-uniform float u_aspect_ratio;
+uniform uint u_sample_index; // which sample of the pixel this pass renders
+uniform uint u_seed;         // global seed chosen by the user
+uniform vec4 u_image_region; // xy: offset of the render target in the image, zw: image size (pixels)
+uniform int u_direct;        // DIRECT_*: how diffuse surfaces gather light from emitters
+uniform int u_restir_gi;     // 1: the primary vertex takes its indirect light from its ReSTIR GI reservoir
+uniform int u_max_depth;     // paths end after this many vertices; 0: MAX_DEPTH
+uniform vec2 u_jitter;       // sub-pixel offset of the camera rays, in pixels (temporal upsampling)
 
 // --- Data Structures and Constants ---
 const int MAT_LAMBERTIAN = 0;
@@ -47,6 +128,15 @@ const int MAT_METAL = 1;
 const int MAT_GLASS = 2;
 const int MAT_EMISSIVE = 3;
 
+const int PROJ_PINHOLE = 0;
+const int PROJ_EQUIRECT = 1;
+const int PROJ_CUBE_FACE = 2;
+const float PI = 3.14159265358979;
+
+const int DIRECT_BSDF = 0;   // emitters are only found by BSDF-sampled rays
+const int DIRECT_NEE = 1;    // plus a shadow ray to one light at every diffuse vertex
+const int DIRECT_RESTIR = 2; // as NEE, but the primary vertex shades with its ReSTIR reservoir
+
 struct MaterialData {
     vec4 baseColor;
     vec4 properties; // x: metallic, y: roughness, z: ior
@@ -64,6 +154,15 @@ struct ObjectData {
     vec3 halfSize;
 };
 
+struct CameraData {
+    mat4 inverseView;
+    vec4 position;
+    int projection;
+    int face; // cube face 0-5: +X, -X, +Y, -Y, +Z, -Z
+    float _padding0;
+    float _padding1;
+};
+
 struct Ray {
     vec3 origin;
     vec3 direction;
@@ -75,9 +174,33 @@ struct HitInfo {
     vec3 point;
     vec3 normal;
     int materialIndex;
+    int objectIndex;
     bool front_face;
 };
 
+struct LightData {
+    vec4 position; // xyz: centre of an emissive sphere, w: its radius
+    vec4 color;    // rgb: emitted radiance, w: index of the sphere in objects[]
+};
+
+// ReSTIR state per pixel. A reservoir holds one light sample y picked out of M candidates and
+// the weight W that makes f(y) * W an estimate of the pixel's direct lighting.
+struct GBufferEntry {
+    vec4 position; // xyz: primary hit, w: its material index, or -1 if it is not diffuse
+    vec4 normal;   // xyz: shading normal, w: distance from the camera
+};
+struct Reservoir {
+    vec4 y;       // xyz: point on a light, w: light index, -1 for none
+    vec4 weights; // x: sum of candidate weights, y: M, z: W
+};
+// ReSTIR GI sample: the second vertex of a path and the radiance it sends to the first.
+struct GIReservoir {
+    vec4 point;    // xyz: second vertex, w: 1; or xyz: direction to the sky, w: 0; w = -1 for none
+    vec4 normal;   // xyz: normal at the second vertex, facing the first; w: 1 if it is diffuse
+    vec4 radiance; // rgb: outgoing radiance towards the first vertex
+    vec4 weights;  // x: sum of candidate weights, y: M, z: W (per unit solid angle at the pixel's hit)
+};
+
 // --- SSBO ---
 layout(std430, binding = 0) buffer ObjectBuffer {
     ObjectData objects[];
@@ -85,19 +208,67 @@ layout(std430, binding = 0) buffer ObjectBuffer {
 layout(std430, binding = 1) buffer MaterialBuffer {
     MaterialData materials[];
 };
+layout(std430, binding = 2) buffer CameraBuffer {
+    CameraData cameras[]; // one per view of the batch
+};
+layout(std430, binding = 7) buffer LightBuffer {
+    vec4 sky;           // x: scale of the background radiance
+    LightData lights[]; // emissive spheres, for explicit light sampling
+};
+layout(std430, binding = 11) buffer FinalReservoirBuffer {
+    Reservoir final_reservoirs[]; // after spatial reuse: shaded this frame, history of the next
+};
+layout(std430, binding = 13) buffer FinalGIReservoirBuffer {
+    GIReservoir final_gi_reservoirs[]; // after spatial reuse
+};
 
 // --- Utilities ---
-uint seed = uint(gl_FragCoord.x) * uint(1973) + uint(gl_FragCoord.y) * uint(9277) + uint(u_time * 1000.0) * uint(26699);
+// Each (pixel, sample index, global seed, stream) starts its own stream, so a render depends
+// only on which samples were taken, never on when. Views and passes pick different streams;
+// stream 0 (view 0) uses the global seed unchanged.
+uint seed;
+uint pcg_hash(uint v) {
+    uint state = v * 747796405u + 2891336453u;
+    uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+void init_random(uvec2 pixel, uint stream) {
+    seed = pcg_hash(pixel.x + pcg_hash(pixel.y + pcg_hash(u_sample_index + pcg_hash(u_seed ^ stream))));
+}
 float random() {
     seed = seed * uint(1664525) + uint(1013904223);
     return float(seed & uint(0x00FFFFFF)) / float(0x01000000);
 }
 
+// Cosine-weighted direction around the unit vector n (pdf cos / PI).
+vec3 cosine_direction(vec3 n) {
+    float cos_t = sqrt(random()), sin_t = sqrt(max(1.0 - cos_t * cos_t, 0.0)), phi = 2.0 * PI * random();
+    vec3 u = normalize(cross(abs(n.x) > 0.9 ? vec3(0.0, 1.0, 0.0) : vec3(1.0, 0.0, 0.0), n)), v = cross(n, u);
+    return (u * cos(phi) + v * sin(phi)) * sin_t + n * cos_t;
+}
+
+// The accepted point is copied out inside the branch that ends the loop. Mesa's llvmpipe
+// miscompiles the plain form (return p from inside the loop, or assign p every iteration): x
+// and y of a finished invocation get overwritten by its SIMD neighbours' later iterations.
 vec3 random_in_unit_sphere() {
-    while (true) {
-        vec3 p = vec3(random() * 2.0 - 1.0, random() * 2.0 - 1.0, random() * 2.0 - 1.0);
-        if (dot(p, p) < 1.0) return p;
+    vec3 p = vec3(0.0);
+    for (bool found = false; !found;) {
+        vec3 q = vec3(random() * 2.0 - 1.0, random() * 2.0 - 1.0, random() * 2.0 - 1.0);
+        if (dot(q, q) < 1.0) { p = q; found = true; }
     }
+    return p;
+}
+
+// World-space direction through uv of a cube map face, following the GL cube map layout
+// (face images stored top row first).
+vec3 cube_face_direction(int face, vec2 uv) {
+    float sc = uv.x * 2.0 - 1.0, tc = 1.0 - uv.y * 2.0;
+    if (face == 0) return vec3(1.0, -tc, -sc);
+    if (face == 1) return vec3(-1.0, -tc, sc);
+    if (face == 2) return vec3(sc, 1.0, tc);
+    if (face == 3) return vec3(sc, -1.0, -tc);
+    if (face == 4) return vec3(sc, -tc, 1.0);
+    return vec3(-sc, -tc, -1.0);
 }
 
 vec3 reflect(vec3 v, vec3 n) {
@@ -135,6 +306,7 @@ void intersect_sphere(Ray r, inout HitInfo hit_rec, int object_index) {
             vec3 outward_normal = normalize(hit_rec.point - vec3(obj.modelMatrix[3]));
             set_face_normal(hit_rec, r, outward_normal);
             hit_rec.materialIndex = obj.materialIndex;
+            hit_rec.objectIndex = object_index;
         }
     }
 }
@@ -153,10 +325,401 @@ void intersect_plane(Ray r, inout HitInfo hit_rec, int object_index) {
             hit_rec.point = r.origin + r.direction * t;
             set_face_normal(hit_rec, r, plane_normal);
             hit_rec.materialIndex = obj.materialIndex;
+            hit_rec.objectIndex = object_index;
+        }
+    }
+}
+HitInfo intersect_scene(Ray r) {
+    HitInfo hit_rec;
+    hit_rec.is_hit = false;
+    hit_rec.t = 10000.0;
+    hit_rec.objectIndex = -1;
+    for (int i = 0; i < objects.length(); ++i) {
+        if (objects[i].type == 0) { // Sphere
+            intersect_sphere(r, hit_rec, i);
+        } else if (objects[i].type == 2) { // Plane
+            intersect_plane(r, hit_rec, i);
+        }
+    }
+    return hit_rec;
+}
+
+vec3 background(vec3 direction) {
+    float t = 0.5 * (direction.y + 1.0);
+    return mix(vec3(1.0, 1.0, 1.0), vec3(0.5, 0.7, 1.0), t) * sky.x;
+}
+
+// --- Camera ---
+const float FOV_Y = 60.0; // vertical field of view of pinhole cameras, in degrees
+
+// Ray through the centre of a pixel of the whole image.
+// position: where on the image the ray passes, in pixels; pixel centres are at + 0.5.
+Ray primary_ray(vec2 position, CameraData camera) {
+    vec2 uv = position / u_image_region.zw;
+    vec3 ray_dir;
+    if (camera.projection == PROJ_EQUIRECT) {
+        // Longitude across the image, latitude up it; the centre looks down the camera's -Z.
+        float lon = (uv.x * 2.0 - 1.0) * PI, lat = (uv.y - 0.5) * PI;
+        ray_dir = vec3(sin(lon) * cos(lat), sin(lat), -cos(lon) * cos(lat));
+    } else if (camera.projection == PROJ_CUBE_FACE) {
+        ray_dir = normalize(cube_face_direction(camera.face, uv)); // inverseView is the identity
+    } else {
+        float aspect_ratio = u_image_region.z / u_image_region.w;
+        float tan_half_fov = tan(radians(FOV_Y) / 2.0);
+        ray_dir = normalize(vec3(
+            (uv.x * 2.0 - 1.0) * aspect_ratio * tan_half_fov,
+            (uv.y * 2.0 - 1.0) * tan_half_fov,
+            -1.0
+        ));
+    }
+    return Ray(camera.position.xyz, (camera.inverseView * vec4(ray_dir, 0.0)).xyz);
+}
+
+// The inverse of primary_ray() for a pinhole camera with this view matrix: where the point
+// lands on the image, in [0, 1] across it. Only meaningful in front of the camera, where
+// (view * point).z < 0. Reprojection (ReSTIR, TAAU) is limited to pinhole cameras.
+vec2 project_to_screen(mat4 view, vec3 point, float aspect_ratio) {
+    vec4 p = view * vec4(point, 1.0);
+    float tan_half_fov = tan(radians(FOV_Y) / 2.0);
+    return vec2(p.x / (aspect_ratio * tan_half_fov), p.y / tan_half_fov) / -p.z * 0.5 + 0.5;
+}
+
+// --- Light Sampling ---
+float luminance(vec3 c) { return dot(c, vec3(0.2126, 0.7152, 0.0722)); }
+
+// Picks a light uniformly and a direction uniformly inside the cone its sphere subtends from
+// x. Returns the point y seen on the sphere and the solid-angle pdf of the direction.
+bool sample_light(vec3 x, out int light, out vec3 y, out float pdf) {
+    int count = lights.length();
+    if (count == 0) return false;
+    light = min(int(random() * float(count)), count - 1);
+    vec3 to_center = lights[light].position.xyz - x;
+    float radius = lights[light].position.w, d2 = dot(to_center, to_center), s = radius * radius / d2;
+    if (s >= 1.0) return false;
+    float one_minus_cos_max = s / (1.0 + sqrt(1.0 - s)); // 1 - cos(half angle), without cancellation
+    float cos_t = 1.0 - random() * one_minus_cos_max, sin_t = sqrt(max(1.0 - cos_t * cos_t, 0.0)), phi = 2.0 * PI * random();
+    vec3 w = to_center * inversesqrt(d2);
+    vec3 u = normalize(cross(abs(w.x) > 0.9 ? vec3(0.0, 1.0, 0.0) : vec3(1.0, 0.0, 0.0), w)), v = cross(w, u);
+    vec3 dir = (u * cos(phi) + v * sin(phi)) * sin_t + w * cos_t;
+    float b = dot(dir, to_center);
+    y = x + dir * (b - sqrt(max(b * b - d2 + radius * radius, 0.0)));
+    pdf = 1.0 / (2.0 * PI * one_minus_cos_max * float(count));
+    return true;
+}
+
+// Picks a light uniformly and a point uniformly on the half of its sphere that faces x. The
+// density per unit area is the same for every point, which keeps reused samples' weights
+// bounded where cone sampling would give silhouette points huge ones.
+bool sample_light_area(vec3 x, out int light, out vec3 y, out float area_pdf) {
+    int count = lights.length();
+    if (count == 0) return false;
+    light = min(int(random() * float(count)), count - 1);
+    vec3 center = lights[light].position.xyz;
+    float radius = lights[light].position.w;
+    vec3 d = random_in_unit_sphere();
+    d = normalize(length(d) > 1e-4 ? d : vec3(0.0, 1.0, 0.0));
+    y = center + radius * (dot(d, x - center) < 0.0 ? -d : d);
+    area_pdf = 1.0 / (2.0 * PI * radius * radius * float(count));
+    return true;
+}
+
+// Light from point y of a light reflected by a diffuse point x towards the viewer, per unit
+// area of the light: the direct lighting integrand in area measure, without visibility.
+vec3 direct_integrand(vec3 x, vec3 n, vec3 albedo, int light, vec3 y) {
+    vec3 to_y = y - x;
+    float d2 = dot(to_y, to_y);
+    vec3 w = to_y * inversesqrt(d2);
+    float cos_x = max(dot(n, w), 0.0), cos_y = max(dot(normalize(y - lights[light].position.xyz), -w), 0.0);
+    return albedo / PI * lights[light].color.rgb * cos_x * cos_y / d2;
+}
+
+bool light_visible(vec3 x, int light, vec3 y) {
+    HitInfo hit = intersect_scene(Ray(x, normalize(y - x)));
+    return hit.is_hit && hit.objectIndex == int(lights[light].color.w);
+}
+
+// Next-event estimation: one shadow ray to one sampled light.
+vec3 sample_direct(HitInfo rec, vec3 albedo) {
+    int light; vec3 y; float pdf;
+    if (!sample_light(rec.point, light, y, pdf) || !light_visible(rec.point, light, y)) return vec3(0.0);
+    return albedo / PI * lights[light].color.rgb * max(dot(rec.normal, normalize(y - rec.point)), 0.0) / pdf;
+}
+
+// --- ReSTIR Reservoirs ---
+Reservoir empty_reservoir() { return Reservoir(vec4(0.0, 0.0, 0.0, -1.0), vec4(0.0)); }
+
+// Target function of resampling at a G-buffer pixel: the luminance of the unshadowed
+// integrand, so samples are picked in proportion to what they would contribute.
+float restir_target(GBufferEntry g, vec4 y) {
+    if (g.position.w < 0.0 || y.w < 0.0) return 0.0;
+    return luminance(direct_integrand(g.position.xyz, g.normal.xyz, materials[int(g.position.w)].baseColor.rgb, int(y.w), y.xyz));
+}
+
+// Weighted reservoir sampling: stream in a candidate of weight w standing for m samples.
+void reservoir_add(inout Reservoir r, vec4 y, float w, float m) {
+    r.weights.x += w;
+    r.weights.y += m;
+    if (w > 0.0 && random() * r.weights.x < w) r.y = y;
+}
+
+// Streams in another pixel's reservoir, reweighted by this pixel's target function.
+void reservoir_merge(inout Reservoir r, Reservoir other, GBufferEntry g) {
+    reservoir_add(r, other.y, restir_target(g, other.y) * other.weights.z * other.weights.y, other.weights.y);
+}
+
+// W normalises by the candidates that could have produced the chosen sample: merged
+// reservoirs of pixels where it has no contribution (a light behind their surface) do not
+// dilute it, which would darken the image.
+void reservoir_finish(inout Reservoir r, GBufferEntry g, float z) {
+    float target = restir_target(g, r.y);
+    r.weights.z = target > 0.0 && z > 0.0 ? r.weights.x / (z * target) : 0.0;
+}
+void reservoir_finish(inout Reservoir r, GBufferEntry g) { reservoir_finish(r, g, r.weights.y); }
+
+// Pixels share reservoirs only when they see nearly the same surface: similar normals, and a
+// distance within 10% of the one expected.
+bool restir_similar(GBufferEntry a, GBufferEntry b, float expected_distance) {
+    return b.position.w >= 0.0 && dot(a.normal.xyz, b.normal.xyz) > 0.9 && abs(b.normal.w - expected_distance) < 0.1 * expected_distance;
+}
+
+// --- ReSTIR GI Reservoirs ---
+// A GI sample found from one pixel's hit x_q is reused at another hit x_r by reconnecting x_r
+// to the same second vertex, which assumes that vertex reflects diffusely.
+GIReservoir empty_gi_reservoir() { return GIReservoir(vec4(0.0, 0.0, 0.0, -1.0), vec4(0.0), vec4(0.0), vec4(0.0)); }
+
+vec3 gi_direction(GIReservoir s, vec3 x) { return s.point.w > 0.5 ? normalize(s.point.xyz - x) : s.point.xyz; }
+
+float gi_target(GBufferEntry g, GIReservoir s) {
+    if (g.position.w < 0.0 || s.point.w < 0.0) return 0.0;
+    vec3 albedo = materials[int(g.position.w)].baseColor.rgb;
+    return luminance(albedo / PI * s.radiance.rgb) * max(dot(g.normal.xyz, gi_direction(s, g.position.xyz)), 0.0);
+}
+
+// Solid angle at x_from per solid angle at x_to around the reconnection, which converts the
+// sample's contribution weight from one pixel's measure to the other's. Shifts that stretch
+// it by more than 10x either way are rejected rather than risk fireflies.
+float gi_jacobian(GIReservoir s, vec3 x_from, vec3 x_to) {
+    if (s.point.w < 0.5) return 1.0; // sky: the same direction from everywhere
+    vec3 from = x_from - s.point.xyz, to = x_to - s.point.xyz;
+    if (s.normal.w < 0.5 && dot(to - from, to - from) > 1e-8) return 0.0;
+    float cos_from = dot(s.normal.xyz, normalize(from)), cos_to = dot(s.normal.xyz, normalize(to));
+    if (cos_from <= 0.0 || cos_to <= 0.0) return 0.0;
+    float j = cos_to * dot(from, from) / (cos_from * dot(to, to));
+    return j > 0.1 && j < 10.0 ? j : 0.0;
+}
+
+// Streams in a reservoir found at x_from, reweighted by this pixel's target function.
+void gi_merge(inout GIReservoir r, GIReservoir s, GBufferEntry g, vec3 x_from) {
+    float w = gi_target(g, s) * s.weights.z * s.weights.y * gi_jacobian(s, x_from, g.position.xyz);
+    r.weights.x += w;
+    r.weights.y += s.weights.y;
+    if (w > 0.0 && random() * r.weights.x < w) { r.point = s.point; r.normal = s.normal; r.radiance = s.radiance; }
+}
+
+void gi_finish(inout GIReservoir r, GBufferEntry g, float z) {
+    float target = gi_target(g, r);
+    r.weights.z = target > 0.0 && z > 0.0 ? r.weights.x / (z * target) : 0.0;
+}
+
+// Whether pixel g could have produced sample s itself, for the normalisation of W.
+bool gi_reachable(GBufferEntry g, GIReservoir s, vec3 x_from) { return gi_target(g, s) > 0.0 && gi_jacobian(s, x_from, g.position.xyz) > 0.0; }
+
+bool gi_visible(vec3 x, GIReservoir s) {
+    HitInfo hit = intersect_scene(Ray(x, gi_direction(s, x)));
+    if (s.point.w < 0.5) return !hit.is_hit;
+    return hit.is_hit && hit.t > 0.999 * distance(x, s.point.xyz);
+}
+
+// --- Radiance Cache Uniforms and Buffers ---
+uniform int u_radiance_cache; // 1: end paths in the radiance cache after their first diffuse bounce
+uniform float u_cache_cell_size; // cell edge per unit of distance from the camera
+layout(std430, binding = 3) buffer CacheBuffer {
+    uint cache_keys[CACHE_ENTRIES];      // checksum of the cell in each slot, 0 = free
+    uvec4 cache_accum[CACHE_ENTRIES];    // this pass: fixed-point radiance sums, sample count
+    vec4 cache_radiance[CACHE_ENTRIES];  // resolved mean outgoing radiance, a: samples behind it
+};
+layout(std430, binding = 6) buffer CacheDirtyBuffer {
+    uvec4 cache_dirty_dispatch; // xyz: workgroups of the resolve pass (indirect dispatch), w: dirty slots
+    uint cache_dirty[];         // slots that received samples this pass
+};
+
+// --- Radiance Cache ---
+// World-space hash grid of outgoing radiance at diffuse surfaces. Training paths (a sparse,
+// per-pass random set of pixels) trace in full and add the radiance found behind each of
+// their diffuse vertices to that vertex's cell; all other paths stop at their second diffuse
+// vertex and take the cell's mean instead of tracing on.
+const uint CACHE_PROBES = 8u;
+const float CACHE_MAX_RADIANCE = 64.0;  // clamp per sample so sums cannot overflow
+const float CACHE_MIN_SAMPLES = 16.0;   // cells with fewer samples are traced through
+vec3 cache_camera_pos;
+
+// Cell of a surface point: its position on a grid whose spacing is a few pixel footprints at
+// that distance, doubling with every doubling of the distance to the camera, plus the
+// dominant axis of its normal. x picks the slot, y is the checksum stored in it.
+uvec2 cache_key(vec3 p, vec3 n) {
+    float level = floor(log2(max(distance(p, cache_camera_pos), 0.125)));
+    ivec3 cell = ivec3(floor(p / (u_cache_cell_size * exp2(level))));
+    vec3 a = abs(n);
+    uint axis = a.x > a.y && a.x > a.z ? 0u : (a.y > a.z ? 1u : 2u);
+    uint tag = uint(level) * 8u + axis * 2u + (n[axis] < 0.0 ? 1u : 0u);
+    uint slot = pcg_hash(uint(cell.x) + pcg_hash(uint(cell.y) + pcg_hash(uint(cell.z) + pcg_hash(tag))));
+    uint check = pcg_hash(uint(cell.z) ^ pcg_hash(uint(cell.y) ^ pcg_hash(uint(cell.x) ^ pcg_hash(tag + 0x9E3779B9u))));
+    return uvec2(slot, check | 1u);
+}
+int cache_find(uvec2 key, bool insert) {
+    uint size = CACHE_ENTRIES;
+    for (uint i = 0u; i < CACHE_PROBES; ++i) {
+        uint slot = (key.x + i) % size;
+        uint stored = insert ? atomicCompSwap(cache_keys[slot], 0u, key.y) : cache_keys[slot];
+        if (stored == key.y || (insert && stored == 0u)) return int(slot);
+        if (stored == 0u) return -1;
+    }
+    return -1;
+}
+void cache_add(int slot, vec3 radiance) {
+    if (slot < 0) return;
+    uint count = atomicAdd(cache_accum[slot].w, 1u);
+    if (count == 0u) {
+        uint k = atomicAdd(cache_dirty_dispatch.w, 1u);
+        cache_dirty[k] = uint(slot);
+        if (k % 256u == 0u) atomicAdd(cache_dirty_dispatch.x, 1u);
+    }
+    if (count >= CACHE_MAX_PASS_SAMPLES) return;
+    uvec3 q = uvec3(clamp(radiance, 0.0, CACHE_MAX_RADIANCE) * CACHE_SCALE + 0.5);
+    atomicAdd(cache_accum[slot].x, q.x);
+    atomicAdd(cache_accum[slot].y, q.y);
+    atomicAdd(cache_accum[slot].z, q.z);
+}
+bool cache_lookup(vec3 p, vec3 n, out vec3 radiance) {
+    int slot = cache_find(cache_key(p, n), false);
+    if (slot < 0 || cache_radiance[slot].a < CACHE_MIN_SAMPLES) return false;
+    radiance = cache_radiance[slot].rgb;
+    return true;
+}
+
+// --- Photon Map Uniforms and Buffers ---
+uniform int u_caustics;        // 1: caustics (light -> specular chain -> diffuse vertex) come from the photon map
+uniform float u_photon_radius; // radius of this pass's density estimate
+struct Photon {
+    vec3 position;
+    int next;    // next photon of the same hash cell, -1 at the end of the list
+    vec3 power;  // flux carried, already divided by the number of photons emitted
+    uint normal; // packSnorm4x8 of the surface normal where it landed
+};
+layout(std430, binding = 15) buffer PhotonBuffer { // one block: fragment shaders may only have 16
+    uvec4 photon_header;                  // x: photons stored this pass
+    int photon_heads[PHOTON_GRID_CELLS];  // first photon of each hash cell, -1 for none
+    Photon photons[];
+};
+
+// --- Photon Map ---
+// Caustic photons of one pass in a hash grid of cells twice the radius across, so a
+// search sphere overlaps at most 2x2x2 cells. Each cell is a linked list built by atomics.
+// Glass and perfect mirrors only: fuzzy metal scatters light differently than it gathers it,
+// so photons could not stand in for what camera paths see through it.
+bool is_specular(MaterialData mat) { return mat.type == MAT_GLASS || (mat.type == MAT_METAL && mat.properties.y == 0.0); }
+
+uint photon_slot(ivec3 cell) { return pcg_hash(uint(cell.x) + pcg_hash(uint(cell.y) + pcg_hash(uint(cell.z)))) % PHOTON_GRID_CELLS; }
+
+void photon_store(vec3 p, vec3 n, vec3 power) {
+    uint i = atomicAdd(photon_header.x, 1u);
+    if (i >= uint(photons.length())) return;
+    photons[i].position = p; photons[i].power = power; photons[i].normal = packSnorm4x8(vec4(n, 0.0));
+    photons[i].next = atomicExchange(photon_heads[photon_slot(ivec3(floor(p / (2.0 * u_photon_radius))))], int(i));
+}
+
+// Caustic radiance leaving a diffuse point towards the viewer: the flux of the photons within
+// u_photon_radius that landed on a similarly oriented surface, over the disc they fell on.
+vec3 caustic_radiance(vec3 x, vec3 n, vec3 albedo) {
+    float r2 = u_photon_radius * u_photon_radius;
+    ivec3 base = ivec3(floor(x / (2.0 * u_photon_radius) - 0.5));
+    uint visited[8];
+    vec3 flux = vec3(0.0);
+    for (int c = 0; c < 8; ++c) {
+        uint slot = photon_slot(base + ivec3(c & 1, (c >> 1) & 1, c >> 2));
+        bool seen = false;
+        for (int k = 0; k < c; ++k) seen = seen || visited[k] == slot; // two cells may share a list
+        visited[c] = slot;
+        if (seen) continue;
+        for (int i = photon_heads[slot]; i >= 0; i = photons[i].next) {
+            vec3 d = photons[i].position - x;
+            if (dot(d, d) < r2 && dot(unpackSnorm4x8(photons[i].normal).xyz, n) > 0.5) flux += photons[i].power;
         }
     }
+    return albedo / PI * flux / (PI * r2);
+}
+
+// --- Path Guiding Uniforms and Buffers ---
+uniform int u_guiding;           // 1: diffuse vertices also sample directions from the guiding distributions
+uniform float u_guide_cell_size; // edge of a guiding cell in world units
+uniform float u_guide_log_rate;  // fraction of pixels whose paths log training samples this pass
+const float GUIDE_FRACTION = 0.5; // share of guided directions at trained cells
+struct GuideSample {
+    vec4 direction; // xyz: direction a path left a diffuse vertex in, w: luminance of what came back, times the cosine over the pdf
+    uvec4 cell;     // x: guiding cell of the vertex
+};
+layout(std430, binding = 4) buffer GuideBuffer {
+    uvec4 guide_header;                        // x: samples logged this pass
+    float guide_cdf[GUIDE_CELLS * GUIDE_BINS]; // per cell: cumulative distribution over direction bins, all 0 until trained
+    GuideSample guide_log[];
+};
+
+// --- Path Guiding ---
+// Directional distributions of incident radiance per world-space cell (and normal axis),
+// trained on the CPU from samples that a random subset of paths logs. Bins have equal solid
+// angle: GUIDE_PHI_BINS of azimuth around +y times GUIDE_COS_BINS of the polar cosine.
+bool guide_logging = false; // this path logs its diffuse vertices for training
+
+uint guide_cell(vec3 p, vec3 n) {
+    ivec3 cell = ivec3(floor(p / u_guide_cell_size));
+    vec3 a = abs(n);
+    uint axis = a.x > a.y && a.x > a.z ? 0u : (a.y > a.z ? 1u : 2u);
+    return pcg_hash(uint(cell.x) + pcg_hash(uint(cell.y) + pcg_hash(uint(cell.z) + pcg_hash(axis * 2u + (n[axis] < 0.0 ? 1u : 0u))))) % GUIDE_CELLS;
+}
+uint guide_bin(vec3 d) {
+    float phi = atan(d.z, d.x);
+    uint p = min(uint((phi < 0.0 ? phi + 2.0 * PI : phi) / (2.0 * PI) * float(GUIDE_PHI_BINS)), GUIDE_PHI_BINS - 1u);
+    uint c = min(uint((d.y * 0.5 + 0.5) * float(GUIDE_COS_BINS)), GUIDE_COS_BINS - 1u);
+    return p * GUIDE_COS_BINS + c;
+}
+bool guide_trained(uint cell) { return guide_cdf[cell * GUIDE_BINS + GUIDE_BINS - 1u] > 0.0; }
+float guide_pdf(uint cell, vec3 d) {
+    uint base = cell * GUIDE_BINS, b = guide_bin(d);
+    return (guide_cdf[base + b] - (b > 0u ? guide_cdf[base + b - 1u] : 0.0)) * float(GUIDE_BINS) / (4.0 * PI);
+}
+vec3 guide_sample(uint cell) {
+    uint base = cell * GUIDE_BINS, lo = 0u, hi = GUIDE_BINS - 1u;
+    float u = random();
+    while (lo < hi) { uint mid = (lo + hi) / 2u; if (guide_cdf[base + mid] > u) hi = mid; else lo = mid + 1u; }
+    float phi = (float(lo / GUIDE_COS_BINS) + random()) * 2.0 * PI / float(GUIDE_PHI_BINS);
+    float y = (float(lo % GUIDE_COS_BINS) + random()) * 2.0 / float(GUIDE_COS_BINS) - 1.0, s = sqrt(max(1.0 - y * y, 0.0));
+    return vec3(s * cos(phi), y, s * sin(phi));
+}
+
+// Scatters at a diffuse vertex of a guided render: from the cell's distribution GUIDE_FRACTION
+// of the time and from the cosine lobe otherwise, weighted by the mixture's pdf (one-sample
+// MIS). Untrained cells use the cosine lobe alone. The lobe is sampled exactly here, since
+// the weight needs its pdf; scatter()'s offset by a point in the unit ball has no simple one.
+bool guide_scatter(HitInfo rec, vec3 albedo, out vec3 attenuation, out Ray scattered, out float pdf) {
+    uint cell = guide_cell(rec.point, rec.normal);
+    bool trained = guide_trained(cell);
+    vec3 dir;
+    if (trained && random() < GUIDE_FRACTION) dir = guide_sample(cell);
+    else dir = cosine_direction(rec.normal);
+    float cos_t = max(dot(rec.normal, dir), 0.0);
+    pdf = cos_t / PI;
+    if (trained) pdf = GUIDE_FRACTION * guide_pdf(cell, dir) + (1.0 - GUIDE_FRACTION) * pdf;
+    attenuation = pdf > 0.0 ? albedo * cos_t / (PI * pdf) : vec3(0.0);
+    scattered = Ray(rec.point, dir);
+    return true;
+}
+
+void guide_log_sample(uint cell, vec3 direction, float weight) {
+    uint i = atomicAdd(guide_header.x, 1u);
+    if (i < uint(guide_log.length())) guide_log[i] = GuideSample(vec4(direction, weight), uvec4(cell, 0u, 0u, 0u));
 }
 
+
 // --- Material Logic ---
 bool scatter(Ray r_in, HitInfo rec, out vec3 attenuation, out Ray scattered) {
     MaterialData mat = materials[rec.materialIndex];
@@ -201,216 +764,4278 @@ bool scatter(Ray r_in, HitInfo rec, out vec3 attenuation, out Ray scattered) {
 
 
 // --- Main Tracing Function ---
-vec3 trace(Ray r) {
+int restir_pixel; // this pixel's reservoirs, for DIRECT_RESTIR and ReSTIR GI
+
+// The primary vertex's direct light, from the light sample ReSTIR chose for this pixel.
+vec3 restir_direct(HitInfo rec, vec3 albedo) {
+    Reservoir r = final_reservoirs[restir_pixel];
+    int light = int(r.y.w);
+    if (light < 0 || r.weights.z <= 0.0 || !light_visible(rec.point, light, r.y.xyz)) return vec3(0.0);
+    return direct_integrand(rec.point, rec.normal, albedo, light, r.y.xyz) * r.weights.z;
+}
+
+// The primary vertex's indirect light, from the path ReSTIR GI chose for this pixel.
+vec3 restir_gi_indirect(HitInfo rec, vec3 albedo) {
+    GIReservoir r = final_gi_reservoirs[restir_pixel];
+    if (r.weights.z <= 0.0 || !gi_visible(rec.point, r)) return vec3(0.0);
+    return albedo / PI * r.radiance.rgb * max(dot(rec.normal, gi_direction(r, rec.point)), 0.0) * r.weights.z;
+}
+
+vec3 primary_point; // set by trace(): the first hit, or a point far along the ray if it escapes
+
+// from_camera: r is a camera ray, so its first hit may shade from the ReSTIR reservoirs.
+// Otherwise r leaves a diffuse vertex that has already gathered the lights itself.
+vec3 trace(Ray r, bool train_cache, bool from_camera) {
     vec3 final_color = vec3(0.0);
     vec3 attenuation = vec3(1.0);
-    int MAX_DEPTH = 8; // Increased depth for glass
+    // Diffuse vertices of a training path: their cache slot, and the throughput and radiance so far.
+    int vertex_slot[MAX_DEPTH]; vec3 vertex_attenuation[MAX_DEPTH], vertex_color[MAX_DEPTH];
+    int vertex_count = 0;
+    bool diffuse_bounced = false;
+    bool light_sampled = !from_camera && u_direct != DIRECT_BSDF; // the previous vertex already gathered the lights by NEE
+    bool diffuse_seen = !from_camera, caustic_path = false; // caustic_path: specular vertices only since a diffuse one
+    // Diffuse vertices of a logging path: cell, direction and cosine over pdf of the bounce, throughput and radiance after it.
+    uint guide_vertex_cell[MAX_DEPTH]; vec4 guide_vertex_direction[MAX_DEPTH]; vec3 guide_vertex_attenuation[MAX_DEPTH], guide_vertex_color[MAX_DEPTH];
+    int guide_vertex_count = 0; float guide_pdf_sampled;
+    int max_depth = u_max_depth > 0 ? min(u_max_depth, MAX_DEPTH) : MAX_DEPTH;
 
-    for (int depth = 0; depth < MAX_DEPTH; ++depth) {
-        HitInfo hit_rec;
-        hit_rec.is_hit = false;
-        hit_rec.t = 10000.0;
-
-        for (int i = 0; i < objects.length(); ++i) {
-            if (objects[i].type == 0) { // Sphere
-                intersect_sphere(r, hit_rec, i);
-            } else if (objects[i].type == 2) { // Plane
-                intersect_plane(r, hit_rec, i);
-            }
-        }
+    for (int depth = 0; depth < max_depth; ++depth) {
+        HitInfo hit_rec = intersect_scene(r);
+        if (depth == 0) primary_point = hit_rec.is_hit ? hit_rec.point : r.origin + r.direction * 1e4;
 
         if (hit_rec.is_hit) {
             Ray scattered;
             vec3 current_attenuation;
             MaterialData mat = materials[hit_rec.materialIndex];
 
-            vec3 emitted = mat.emission.rgb;
+            if (u_radiance_cache != 0 && mat.type == MAT_LAMBERTIAN) {
+                vec3 cached;
+                if (train_cache) {
+                    vertex_slot[vertex_count] = cache_find(cache_key(hit_rec.point, hit_rec.normal), true);
+                    vertex_attenuation[vertex_count] = attenuation; vertex_color[vertex_count] = final_color;
+                    ++vertex_count;
+                } else if (diffuse_bounced && cache_lookup(hit_rec.point, hit_rec.normal, cached)) {
+                    final_color += cached * attenuation;
+                    break;
+                }
+                diffuse_bounced = true;
+            }
+
+            // Sampled lights (emissive spheres) hit right after NEE would be counted twice.
+            // So are caustic paths to them when the photon map carries those.
+            vec3 emitted = (light_sampled || caustic_path) && mat.type == MAT_EMISSIVE && objects[hit_rec.objectIndex].type == 0 ? vec3(0.0) : mat.emission.rgb;
+            light_sampled = u_direct != DIRECT_BSDF && mat.type == MAT_LAMBERTIAN;
+            if (light_sampled)
+                final_color += attenuation * (from_camera && depth == 0 && u_direct == DIRECT_RESTIR ? restir_direct(hit_rec, mat.baseColor.rgb) : sample_direct(hit_rec, mat.baseColor.rgb));
+            if (u_caustics != 0 && mat.type == MAT_LAMBERTIAN) final_color += attenuation * caustic_radiance(hit_rec.point, hit_rec.normal, mat.baseColor.rgb);
+            caustic_path = u_caustics != 0 && is_specular(mat) && (caustic_path || diffuse_seen);
+            diffuse_seen = diffuse_seen || mat.type == MAT_LAMBERTIAN;
+            if (from_camera && depth == 0 && u_restir_gi != 0 && mat.type == MAT_LAMBERTIAN) {
+                final_color += emitted + restir_gi_indirect(hit_rec, mat.baseColor.rgb);
+                break;
+            }
 
-            if (scatter(r, hit_rec, current_attenuation, scattered)) {
+            if (u_guiding != 0 && mat.type == MAT_LAMBERTIAN ? guide_scatter(hit_rec, mat.baseColor.rgb, current_attenuation, scattered, guide_pdf_sampled) : scatter(r, hit_rec, current_attenuation, scattered)) {
                 attenuation *= current_attenuation;
                 r = scattered;
                 final_color += emitted * attenuation;
+                if (guide_logging && mat.type == MAT_LAMBERTIAN && luminance(attenuation) > 0.0) {
+                    guide_vertex_cell[guide_vertex_count] = guide_cell(hit_rec.point, hit_rec.normal);
+                    guide_vertex_direction[guide_vertex_count] = vec4(scattered.direction, dot(hit_rec.normal, scattered.direction) / guide_pdf_sampled);
+                    guide_vertex_attenuation[guide_vertex_count] = attenuation; guide_vertex_color[guide_vertex_count] = final_color;
+                    ++guide_vertex_count;
+                }
             } else {
                 final_color += emitted * attenuation;
                 break;
             }
         } else {
-            // Background (gradient)
-            float t = 0.5 * (r.direction.y + 1.0);
-            final_color += mix(vec3(1.0, 1.0, 1.0), vec3(0.5, 0.7, 1.0), t) * attenuation;
+            if (!caustic_path) final_color += background(r.direction) * attenuation;
             break;
         }
     }
+    // Everything gathered after a vertex, divided by the throughput that reached it, is the
+    // radiance leaving that vertex towards the previous one.
+    for (int i = 0; i < vertex_count; ++i)
+        cache_add(vertex_slot[i], (final_color - vertex_color[i]) / max(vertex_attenuation[i], vec3(1e-4)));
+    // Likewise the radiance each logged bounce brought back, weighted by its cosine over its pdf:
+    // summed per bin, an estimate of the cosine-weighted radiance arriving through the bin.
+    for (int i = 0; i < guide_vertex_count; ++i)
+        guide_log_sample(guide_vertex_cell[i], guide_vertex_direction[i].xyz, luminance((final_color - guide_vertex_color[i]) / max(guide_vertex_attenuation[i], vec3(1e-4))) * guide_vertex_direction[i].w);
     return final_color;
 }
+)";
+
+// The second output is the primary hit point, for targets that reproject their samples
+// (temporal upsampling); other targets have no attachment there.
+const std::string fragmentShaderSource = std::string(tracerCommonSource) + R"(
+layout(location = 0) out vec4 FragColor;
+layout(location = 1) out vec4 FragPosition;
+in ViewData { flat int ViewIndex; };
 
 void main() {
-    vec2 uv = TexCoords;
-    // uv.y = 1.0 - uv.y; // REMOVED to fix the inverted scene
-    
-    float fov_y = 60.0;
-    float tan_half_fov = tan(radians(fov_y) / 2.0);
-
-    vec3 ray_dir = normalize(vec3(
-        (uv.x * 2.0 - 1.0) * u_aspect_ratio * tan_half_fov,
-        (uv.y * 2.0 - 1.0) * tan_half_fov,
-        -1.0
-    ));
-    
-    Ray primary_ray;
-    primary_ray.origin = u_camera_pos;
-    primary_ray.direction = (inverse(u_camera_view) * vec4(ray_dir, 0.0)).xyz;
+    // Pixel position within the whole image, so a tile of a large image generates the same
+    // rays and random streams as the corresponding pixels of a single full-size render.
+    ivec2 pixel = ivec2(u_image_region.xy) + ivec2(gl_FragCoord.xy);
+    init_random(uvec2(pixel), uint(ViewIndex) * 0x9E3779B9u);
+    CameraData camera = cameras[ViewIndex];
+    Ray camera_ray = primary_ray(vec2(pixel) + 0.5 + u_jitter, camera);
+    restir_pixel = pixel.y * int(u_image_region.z) + pixel.x;
 
-    // For anti-aliasing and soft effects, we would have a loop here,
-    // but for the first run, one sample is enough.
-    vec3 color = trace(primary_ray);
+    // Training pixels are picked by a hash of their own, so the choice leaves the pixel's
+    // random stream alone.
+    cache_camera_pos = camera.position.xyz;
+    bool train_cache = u_radiance_cache != 0 && (pcg_hash(uint(pixel.x) ^ pcg_hash(uint(pixel.y) ^ pcg_hash(u_sample_index ^ 0xCAC4Eu))) & 15u) == 0u;
+    guide_logging = u_guiding != 0 && float(pcg_hash(uint(pixel.x) ^ pcg_hash(uint(pixel.y) ^ pcg_hash(u_sample_index ^ 0x6D2B79F5u)))) / 4294967296.0 < u_guide_log_rate;
+
+    // One sample per pass; the result is added into the accumulation buffer
+    // (alpha counts samples) and tone-mapped by the display shader.
+    vec3 color = trace(camera_ray, train_cache, true);
 
-    color = pow(color, vec3(1.0/2.2));
     FragColor = vec4(color, 1.0);
+    FragPosition = vec4(primary_point, 1.0);
 }
 )";
 
+const std::string previewShaderSource = std::string(tracerCommonSource) + R"(
+out vec4 FragColor;
+in ViewData { flat int ViewIndex; };
 
-// --- CPU Data Structures ---
-enum MaterialType { MAT_LAMBERTIAN = 0, MAT_METAL = 1, MAT_GLASS = 2, MAT_EMISSIVE = 3 };
-struct MaterialData { glm::vec4 baseColor; glm::vec4 properties; glm::vec4 emission; int type; int _padding[3]; };
-struct ObjectData { glm::mat4 modelMatrix; glm::mat4 inverseModelMatrix; int materialIndex; int type; float radius; float _padding; glm::vec3 halfSize; float _padding2; };
-struct LightData { glm::vec4 position; glm::vec4 color; };
-struct Material { std::string name; MaterialType type; glm::vec3 color; glm::vec3 emission; float metallic; float roughness; float ior; };
+// --- Preview Modes ---
+// Cheap stand-ins for trace() while the camera moves. They look at the primary hit only,
+// shading every material as diffuse: lit by a headlight (PREVIEW_SHADED), by unoccluded
+// directions within AO_RADIUS (PREVIEW_AO), or by the lights and one sky ray (PREVIEW_DIRECT).
+// A program of their own: the path tracer's costs llvmpipe most of a frame even for pixels
+// that never call trace().
+uniform int u_preview; // PREVIEW_*
+const int PREVIEW_SHADED = 1, PREVIEW_AO = 2, PREVIEW_DIRECT = 3;
+const int AO_RAYS = 4;
+const float AO_RADIUS = 0.5;
 
-class SceneObject {
-public:
-    int id; glm::vec3 position; glm::mat4 rotation; int materialId;
-    SceneObject(int matId) : id(-1), position(0.0f), rotation(1.0f), materialId(matId) {}
-    virtual ~SceneObject() = default;
-    glm::mat4 getModelMatrix() const { return glm::translate(glm::mat4(1.0f), position) * rotation; }
-    virtual ObjectData getGPUData() const = 0;
+vec3 preview(Ray r) {
+    HitInfo hit = intersect_scene(r);
+    if (!hit.is_hit) return background(r.direction);
+    MaterialData mat = materials[hit.materialIndex];
+    if (mat.type == MAT_EMISSIVE) return mat.emission.rgb;
+    vec3 albedo = mat.baseColor.rgb;
+    if (u_preview == PREVIEW_SHADED) return albedo * (0.2 + 0.8 * max(dot(hit.normal, -r.direction), 0.0));
+    if (u_preview == PREVIEW_AO) {
+        int open = 0;
+        for (int i = 0; i < AO_RAYS; ++i) {
+            HitInfo occluder = intersect_scene(Ray(hit.point, cosine_direction(hit.normal)));
+            if (!occluder.is_hit || occluder.t > AO_RADIUS) ++open;
+        }
+        return albedo * float(open) / float(AO_RAYS);
+    }
+    vec3 d = cosine_direction(hit.normal);
+    return sample_direct(hit, albedo) + (intersect_scene(Ray(hit.point, d)).is_hit ? vec3(0.0) : albedo * background(d));
+}
+
+void main() {
+    ivec2 pixel = ivec2(u_image_region.xy) + ivec2(gl_FragCoord.xy);
+    init_random(uvec2(pixel), uint(ViewIndex) * 0x9E3779B9u);
+    FragColor = vec4(preview(primary_ray(vec2(pixel) + 0.5, cameras[ViewIndex])), 1.0);
+}
+)";
+
+// Per-pixel ReSTIR state that only the ReSTIR passes touch; the path tracer reads the final
+// reservoirs declared with the shared code. Kept out of tracerCommonSource, since every
+// storage block it declares counts against the fragment shader's limit.
+const char* restirBuffersSource = R"(
+layout(std430, binding = 8) buffer GBuffer {
+    GBufferEntry gbuffer[];
 };
-class Sphere : public SceneObject {
-public:
-    float radius;
-    Sphere(glm::vec3 pos, float r, int matId) : SceneObject(matId), radius(r) { position = pos; }
-    ObjectData getGPUData() const override { ObjectData d{}; d.modelMatrix = getModelMatrix(); d.inverseModelMatrix = glm::inverse(d.modelMatrix); d.materialIndex = materialId; d.type = 0; d.radius = radius; return d; }
+layout(std430, binding = 9) buffer PrevGBuffer {
+    GBufferEntry prev_gbuffer[]; // last frame's, for temporal reuse
 };
-// ADDED CLASS FOR PLANE
-class Plane : public SceneObject {
-public:
-    Plane(glm::vec3 pos, int matId) : SceneObject(matId) { position = pos; }
-    ObjectData getGPUData() const override { ObjectData d{}; d.modelMatrix = getModelMatrix(); d.inverseModelMatrix = glm::inverse(d.modelMatrix); d.materialIndex = materialId; d.type = 2; return d; }
+layout(std430, binding = 10) buffer ReservoirBuffer {
+    Reservoir reservoirs[]; // after initial candidates and temporal reuse
 };
-class Scene {
-public:
-    std::vector<SceneObject*> objects; std::vector<Material> materials;
-    ~Scene() { for (auto obj : objects) delete obj; }
-    int addMaterial(const Material& mat) { materials.push_back(mat); return materials.size() - 1; }
-    void addObject(SceneObject* obj) { obj->id = objects.size(); objects.push_back(obj); }
+layout(std430, binding = 12) buffer GIReservoirBuffer {
+    GIReservoir gi_reservoirs[]; // after the initial path and temporal reuse
 };
+layout(std430, binding = 14) buffer PrevGIReservoirBuffer {
+    GIReservoir prev_gi_reservoirs[]; // last frame's gi_reservoirs: spatial results are not fed back
+};
+)";
 
-// --- Shader Compilation Functions ---
-void compileShader(GLuint shader, const std::string& type) { glCompileShader(shader); GLint success; glGetShaderiv(shader, GL_COMPILE_STATUS, &success); if (!success) { char infoLog[1024]; glGetShaderInfoLog(shader, 1024, NULL, infoLog); throw std::runtime_error("SHADER_COMPILATION_ERROR of type: " + type + "\n" + infoLog); } }
-GLuint createShaderProgram() { GLuint vs = glCreateShader(GL_VERTEX_SHADER); glShaderSource(vs, 1, &vertexShaderSource, NULL); compileShader(vs, "VERTEX"); GLuint fs = glCreateShader(GL_FRAGMENT_SHADER); glShaderSource(fs, 1, &fragmentShaderSource, NULL); compileShader(fs, "FRAGMENT"); GLuint prog = glCreateProgram(); glAttachShader(prog, vs); glAttachShader(prog, fs); glLinkProgram(prog); GLint success; glGetProgramiv(prog, GL_LINK_STATUS, &success); if (!success) { char infoLog[1024]; glGetProgramInfoLog(prog, 1024, NULL, infoLog); throw std::runtime_error("SHADER_PROGRAM_LINKING_ERROR\n" + std::string(infoLog)); } glDeleteShader(vs); glDeleteShader(fs); return prog; }
+// Which pixel each invocation of an 8x8 per-pixel compute pass shades. Scanline order is the
+// plain grid. The curve orders swizzle the workgroup index: the grid is cut into blocks of
+// SWIZZLE_BLOCK x SWIZZLE_BLOCK workgroups, taken in rows, and a Morton or Hilbert curve
+// runs through each block, so workgroups scheduled together touch neighbouring pixels and
+// share cache lines. Partial blocks at the right and bottom edges run row by row. Threads
+// walk their 8x8 tile in Morton order, keeping narrow SIMD groups square rather than a row
+// wide.
+const char* dispatchOrderSource = R"(
+uniform int u_traversal; // TRAVERSAL_*
+const int TRAVERSAL_SCANLINE = 0;
+const int TRAVERSAL_MORTON = 1;
+const int TRAVERSAL_HILBERT = 2;
+const uint SWIZZLE_BLOCK = 8u; // workgroups per side of a curve block, a power of two
 
+uint compact_bits(uint v) {
+    v &= 0x55555555u;
+    v = (v | (v >> 1)) & 0x33333333u; v = (v | (v >> 2)) & 0x0F0F0F0Fu;
+    v = (v | (v >> 4)) & 0x00FF00FFu; v = (v | (v >> 8)) & 0x0000FFFFu;
+    return v;
+}
+uvec2 morton_decode(uint d) { return uvec2(compact_bits(d), compact_bits(d >> 1)); }
+// Point d of the Hilbert curve through an n x n grid, n a power of two.
+uvec2 hilbert_decode(uint n, uint d) {
+    uvec2 p = uvec2(0u);
+    for (uint s = 1u; s < n; s *= 2u) {
+        uint rx = 1u & (d / 2u), ry = 1u & (d ^ rx);
+        if (ry == 0u) { if (rx == 1u) p = uvec2(s - 1u) - p; p = p.yx; }
+        p += s * uvec2(rx, ry);
+        d /= 4u;
+    }
+    return p;
+}
+ivec2 dispatch_pixel() {
+    if (u_traversal == TRAVERSAL_SCANLINE) return ivec2(gl_GlobalInvocationID.xy);
+    const uint S = SWIZZLE_BLOCK;
+    uvec2 groups = gl_NumWorkGroups.xy;
+    uint group = gl_WorkGroupID.y * groups.x + gl_WorkGroupID.x;
+    uint row = group / (S * groups.x), h = min(S, groups.y - row * S), in_row = group - row * S * groups.x;
+    uint block = in_row / (S * h), w = min(S, groups.x - block * S), in_block = in_row - block * S * h;
+    uvec2 p = w < S || h < S ? uvec2(in_block % w, in_block / w) : u_traversal == TRAVERSAL_MORTON ? morton_decode(in_block) : hilbert_decode(S, in_block);
+    return ivec2((uvec2(block, row) * S + p) * 8u + morton_decode(gl_LocalInvocationIndex));
+}
+)";
 
-// --- Main Program ---
-int main(int argc, char* argv[]) {
-    (void)argc; (void)argv;
-    if (SDL_Init(SDL_INIT_VIDEO) < 0) throw std::runtime_error("SDL Init Failed");
-    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 4);
-    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
-    SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
-    SDL_Window* window = SDL_CreateWindow("Hybrid Ray Tracer - Step 3 (Photoreal)", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_OPENGL);
-    SDL_GLContext context = SDL_GL_CreateContext(window);
-    glewExperimental = GL_TRUE;
-    if (glewInit() != GLEW_OK) throw std::runtime_error("GLEW Init Failed");
+// ReSTIR direct lighting, run before the fragment shader for single full-frame pinhole views.
+// The initial pass traces the primary hit into the G-buffer, picks a light sample out of
+// RESTIR_CANDIDATES by RIS, drops it if occluded, and merges it with last frame's reservoir
+// of the same surface point; the spatial pass merges in a few similar neighbours.
+const std::string restirInitialShaderSource = std::string(tracerCommonSource) + restirBuffersSource + dispatchOrderSource + R"(
+layout (local_size_x = 8, local_size_y = 8) in;
+uniform int u_restir_temporal; // 1: prev_gbuffer and final_reservoirs hold last frame's
+uniform mat4 u_prev_view;      // last frame's view matrix, for reprojection
+const int RESTIR_CANDIDATES = 32;
+const float RESTIR_HISTORY = 20.0; // temporal M is capped at this many frames of candidates
+void main() {
+    ivec2 size = ivec2(u_image_region.zw), pixel = dispatch_pixel();
+    if (any(greaterThanEqual(pixel, size))) return;
+    init_random(uvec2(pixel), 0x2545F491u);
+    int index = pixel.y * size.x + pixel.x;
+    HitInfo hit = intersect_scene(primary_ray(vec2(pixel) + 0.5 + u_jitter, cameras[0]));
+    GBufferEntry g = GBufferEntry(vec4(hit.point, -1.0), vec4(hit.normal, hit.t));
+    if (hit.is_hit && materials[hit.materialIndex].type == MAT_LAMBERTIAN) g.position.w = float(hit.materialIndex);
+    gbuffer[index] = g;
+    Reservoir r = empty_reservoir();
+    if (g.position.w < 0.0) { reservoirs[index] = r; return; }
 
-    // --- Scene Creation (CPU) ---
-    Scene scene;
-    int ground_mat_id = scene.addMaterial({"Ground", MAT_LAMBERTIAN, {0.5f, 0.5f, 0.5f}, {}, 0.0f, 1.0f, 1.0f});
-    int center_mat_id = scene.addMaterial({"Center", MAT_GLASS, {1.0f, 1.0f, 1.0f}, {}, 0.0f, 0.0f, 1.52f});
-    int left_mat_id = scene.addMaterial({"Left Metal", MAT_METAL, {0.8f, 0.8f, 0.8f}, {}, 1.0f, 0.0f, 1.0f});
-    int right_mat_id = scene.addMaterial({"Right Metal", MAT_METAL, {0.8f, 0.6f, 0.2f}, {}, 1.0f, 0.3f, 1.0f});
+    // Candidate weights are target over source pdf, both per unit light area.
+    for (int i = 0; i < RESTIR_CANDIDATES; ++i) {
+        int light; vec3 y; float area_pdf;
+        if (!sample_light_area(hit.point, light, y, area_pdf)) { r.weights.y += 1.0; continue; }
+        vec4 candidate = vec4(y, float(light));
+        reservoir_add(r, candidate, restir_target(g, candidate) / area_pdf, 1.0);
+    }
+    reservoir_finish(r, g);
+    if (r.y.w >= 0.0 && !light_visible(hit.point, int(r.y.w), r.y.xyz)) r.weights.z = 0.0;
 
-    scene.addObject(new Plane({0.0f, -0.5f, 0.0f}, ground_mat_id));
-    scene.addObject(new Sphere({0.0f, 0.0f, 0.0f}, 0.5f, center_mat_id));
-    scene.addObject(new Sphere({-1.2f, 0.0f, 0.0f}, 0.5f, left_mat_id));
-    scene.addObject(new Sphere({1.2f, 0.0f, 0.0f}, 0.5f, right_mat_id));
+    if (u_restir_temporal != 0) {
+        vec4 p = u_prev_view * vec4(hit.point, 1.0);
+        ivec2 prev = ivec2(floor(project_to_screen(u_prev_view, hit.point, u_image_region.z / u_image_region.w) * u_image_region.zw));
+        if (p.z < 0.0 && all(greaterThanEqual(prev, ivec2(0))) && all(lessThan(prev, size))) {
+            int prev_index = prev.y * size.x + prev.x;
+            if (restir_similar(g, prev_gbuffer[prev_index], length(p.xyz))) {
+                Reservoir history = final_reservoirs[prev_index];
+                history.weights.y = min(history.weights.y, RESTIR_HISTORY * float(RESTIR_CANDIDATES));
+                Reservoir merged = empty_reservoir();
+                reservoir_merge(merged, r, g);
+                reservoir_merge(merged, history, g);
+                GBufferEntry prev_g = prev_gbuffer[prev_index];
+                reservoir_finish(merged, g, r.weights.y + (restir_target(prev_g, merged.y) > 0.0 ? history.weights.y : 0.0));
+                r = merged;
+            }
+        }
+    }
+    reservoirs[index] = r;
+}
+)";
+
+// Spatial reuse without visibility re-checks: a neighbour's sample may be occluded here, which
+// darkens contact shadows slightly but costs no extra rays.
+const std::string restirSpatialShaderSource = std::string(tracerCommonSource) + restirBuffersSource + dispatchOrderSource + R"(
+layout (local_size_x = 8, local_size_y = 8) in;
+const int RESTIR_NEIGHBOURS = 5;
+const float RESTIR_RADIUS = 30.0; // pixels
+void main() {
+    ivec2 size = ivec2(u_image_region.zw), pixel = dispatch_pixel();
+    if (any(greaterThanEqual(pixel, size))) return;
+    init_random(uvec2(pixel), 0x68E31DA4u);
+    int index = pixel.y * size.x + pixel.x;
+    GBufferEntry g = gbuffer[index];
+    Reservoir r = reservoirs[index];
+    if (g.position.w >= 0.0) {
+        Reservoir merged = empty_reservoir();
+        reservoir_merge(merged, r, g);
+        int used[RESTIR_NEIGHBOURS], used_count = 0;
+        for (int i = 0; i < RESTIR_NEIGHBOURS; ++i) {
+            float angle = 2.0 * PI * random(), radius = RESTIR_RADIUS * sqrt(random());
+            ivec2 q = pixel + ivec2(round(radius * vec2(cos(angle), sin(angle))));
+            if (q == pixel || any(lessThan(q, ivec2(0))) || any(greaterThanEqual(q, size))) continue;
+            int q_index = q.y * size.x + q.x;
+            if (!restir_similar(g, gbuffer[q_index], g.normal.w)) continue;
+            reservoir_merge(merged, reservoirs[q_index], g);
+            used[used_count++] = q_index;
+        }
+        float z = r.weights.y;
+        for (int i = 0; i < used_count; ++i) if (restir_target(gbuffer[used[i]], merged.y) > 0.0) z += reservoirs[used[i]].weights.y;
+        reservoir_finish(merged, g, z);
+        r = merged;
+    }
+    final_reservoirs[index] = r;
+}
+)";
 
-    // --- Preparing Data for GPU ---
-    std::vector<ObjectData> object_gpu_data;
-    for (const auto& obj : scene.objects) object_gpu_data.push_back(obj->getGPUData());
-    std::vector<MaterialData> material_gpu_data;
-    for (const auto& mat : scene.materials) {
-        MaterialData d{}; d.baseColor=glm::vec4(mat.color,1); d.emission=glm::vec4(mat.emission,1); d.properties=glm::vec4(mat.metallic, mat.roughness, mat.ior,0); d.type=mat.type; material_gpu_data.push_back(d);
-    }
-
-    // --- Creating SSBOs ---
-    GLuint object_ssbo, material_ssbo;
-    glGenBuffers(1, &object_ssbo);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, object_ssbo);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, object_gpu_data.size() * sizeof(ObjectData), object_gpu_data.data(), GL_DYNAMIC_DRAW);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, object_ssbo);
-    glGenBuffers(1, &material_ssbo);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, material_ssbo);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, material_gpu_data.size() * sizeof(MaterialData), material_gpu_data.data(), GL_STATIC_DRAW);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, material_ssbo);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-
-    // --- Creating Shader Program and Fullscreen Quad ---
-    GLuint shaderProgram = createShaderProgram();
-    float quadVertices[] = { 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f };
-    GLuint VBO_quad, VAO_quad;
-    glGenVertexArrays(1, &VAO_quad); glGenBuffers(1, &VBO_quad);
-    glBindVertexArray(VAO_quad); glBindBuffer(GL_ARRAY_BUFFER, VBO_quad);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), &quadVertices, GL_STATIC_DRAW);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
-    glBindVertexArray(0);
-
-    // Get uniform locations
-    glUseProgram(shaderProgram);
-    GLint cameraPosLoc = glGetUniformLocation(shaderProgram, "u_camera_pos");
-    GLint cameraViewLoc = glGetUniformLocation(shaderProgram, "u_camera_view");
-    GLint timeLoc = glGetUniformLocation(shaderProgram, "u_time");
-    GLint aspectLoc = glGetUniformLocation(shaderProgram, "u_aspect_ratio");
-    glUniform1f(aspectLoc, (float)SCREEN_WIDTH / (float)SCREEN_HEIGHT);
+// ReSTIR GI: the initial pass traces one path from each pixel's primary hit (its first
+// direction drawn as trace() would) and keeps its second vertex and the radiance behind it
+// as the pixel's sample, merged with last frame's temporal reservoir; the spatial pass merges
+// similar neighbours. Every reuse reconnects to the sample's second vertex through
+// gi_jacobian(). Spatial results are only shaded, never kept as history: a sample that is
+// bright for this pixel only by a large cosine ratio would otherwise persist for many frames.
+const std::string restirGIInitialShaderSource = std::string(tracerCommonSource) + restirBuffersSource + dispatchOrderSource + R"(
+layout (local_size_x = 8, local_size_y = 8) in;
+uniform int u_restir_temporal; // 1: prev_gbuffer and prev_gi_reservoirs hold last frame's
+uniform mat4 u_prev_view;      // last frame's view matrix, for reprojection
+const float RESTIR_GI_HISTORY = 30.0; // temporal M cap, in frames
+void main() {
+    ivec2 size = ivec2(u_image_region.zw), pixel = dispatch_pixel();
+    if (any(greaterThanEqual(pixel, size))) return;
+    init_random(uvec2(pixel), 0x1B873593u);
+    int index = pixel.y * size.x + pixel.x;
+    cache_camera_pos = cameras[0].position.xyz;
+    HitInfo hit = intersect_scene(primary_ray(vec2(pixel) + 0.5 + u_jitter, cameras[0]));
+    GBufferEntry g = GBufferEntry(vec4(hit.point, -1.0), vec4(hit.normal, hit.t));
+    if (hit.is_hit && materials[hit.materialIndex].type == MAT_LAMBERTIAN) g.position.w = float(hit.materialIndex);
+    gbuffer[index] = g;
+    GIReservoir r = empty_gi_reservoir();
+    if (g.position.w < 0.0) { gi_reservoirs[index] = r; return; }
 
-    // --- Main Loop ---
-    bool quit = false;
-    SDL_Event e;
-    auto startTime = std::chrono::high_resolution_clock::now();
-    
-    while (!quit) {
-        while (SDL_PollEvent(&e) != 0) {
-            if (e.type == SDL_QUIT || (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_ESCAPE)) quit = true;
+    // One candidate per frame. Its pdf is taken as cos/pi, as the path tracer's throughput
+    // update assumes, so a lone sample gives exactly the path tracer's estimate.
+    vec3 dir = hit.normal + random_in_unit_sphere();
+    dir = length(dir) < 0.001 ? hit.normal : normalize(dir);
+    Ray bounce = Ray(hit.point, dir);
+    HitInfo second = intersect_scene(bounce);
+    if (second.is_hit) r = GIReservoir(vec4(second.point, 1.0), vec4(second.normal, materials[second.materialIndex].type == MAT_LAMBERTIAN ? 1.0 : 0.0), vec4(0.0), vec4(0.0));
+    else r = GIReservoir(vec4(dir, 0.0), vec4(-dir, 1.0), vec4(0.0), vec4(0.0));
+    r.radiance = vec4(trace(bounce, false, false), 0.0);
+    float pdf = max(dot(hit.normal, dir), 0.0) / PI;
+    r.weights = vec4(pdf > 0.0 ? gi_target(g, r) / pdf : 0.0, 1.0, 0.0, 0.0);
+    gi_finish(r, g, 1.0);
+
+    if (u_restir_temporal != 0) {
+        vec4 p = u_prev_view * vec4(hit.point, 1.0);
+        ivec2 prev = ivec2(floor(project_to_screen(u_prev_view, hit.point, u_image_region.z / u_image_region.w) * u_image_region.zw));
+        if (p.z < 0.0 && all(greaterThanEqual(prev, ivec2(0))) && all(lessThan(prev, size))) {
+            int prev_index = prev.y * size.x + prev.x;
+            GBufferEntry prev_g = prev_gbuffer[prev_index];
+            if (restir_similar(g, prev_g, length(p.xyz))) {
+                GIReservoir history = prev_gi_reservoirs[prev_index];
+                history.weights.y = min(history.weights.y, RESTIR_GI_HISTORY);
+                GIReservoir merged = empty_gi_reservoir();
+                gi_merge(merged, r, g, hit.point);
+                gi_merge(merged, history, g, prev_g.position.xyz);
+                gi_finish(merged, g, 1.0 + (gi_reachable(prev_g, merged, hit.point) ? history.weights.y : 0.0));
+                r = merged;
+            }
         }
-        
-        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT);
+    }
+    gi_reservoirs[index] = r;
+}
+)";
 
-        glUseProgram(shaderProgram);
-        auto currentTime = std::chrono::high_resolution_clock::now();
-        float time = std::chrono::duration<float>(currentTime - startTime).count();
-        
-        // Simple camera animation
-        glm::vec3 cam_pos = glm::vec3(cos(time * 0.3) * 4.0, 1.5, sin(time * 0.3) * 4.0);
-        glm::mat4 view_matrix = glm::lookAt(cam_pos, glm::vec3(0,0,0), glm::vec3(0,1,0));
+const std::string restirGISpatialShaderSource = std::string(tracerCommonSource) + restirBuffersSource + dispatchOrderSource + R"(
+layout (local_size_x = 8, local_size_y = 8) in;
+const int RESTIR_NEIGHBOURS = 5;
+const float RESTIR_RADIUS = 30.0; // pixels
+void main() {
+    ivec2 size = ivec2(u_image_region.zw), pixel = dispatch_pixel();
+    if (any(greaterThanEqual(pixel, size))) return;
+    init_random(uvec2(pixel), 0xE6546B64u);
+    int index = pixel.y * size.x + pixel.x;
+    GBufferEntry g = gbuffer[index];
+    GIReservoir r = gi_reservoirs[index];
+    if (g.position.w >= 0.0) {
+        // Candidate 0 is this pixel's own reservoir, the rest similar neighbours'.
+        GIReservoir c[RESTIR_NEIGHBOURS + 1]; GBufferEntry c_g[RESTIR_NEIGHBOURS + 1];
+        c[0] = r; c_g[0] = g;
+        int n = 1;
+        for (int i = 0; i < RESTIR_NEIGHBOURS; ++i) {
+            float angle = 2.0 * PI * random(), radius = RESTIR_RADIUS * sqrt(random());
+            ivec2 q = pixel + ivec2(round(radius * vec2(cos(angle), sin(angle))));
+            if (q == pixel || any(lessThan(q, ivec2(0))) || any(greaterThanEqual(q, size))) continue;
+            int q_index = q.y * size.x + q.x;
+            if (!restir_similar(g, gbuffer[q_index], g.normal.w)) continue;
+            c[n] = gi_reservoirs[q_index]; c_g[n] = gbuffer[q_index]; ++n;
+        }
+        // Each candidate is weighted by the balance heuristic over the pixels that could have
+        // found it (targets in this pixel's measure). Plain 1/M weights would let a sample
+        // seen at a grazing angle by its own pixel dominate here by the ratio of cosines.
+        GIReservoir merged = empty_gi_reservoir();
+        for (int i = 0; i < n; ++i) {
+            float own = 0.0, total = 0.0;
+            for (int j = 0; j < n; ++j) {
+                float p = c[j].weights.y * gi_target(c_g[j], c[i]) * gi_jacobian(c[i], g.position.xyz, c_g[j].position.xyz);
+                total += p;
+                if (j == i) own = p;
+            }
+            float w = total > 0.0 ? own / total * gi_target(g, c[i]) * c[i].weights.z * gi_jacobian(c[i], c_g[i].position.xyz, g.position.xyz) : 0.0;
+            merged.weights.x += w;
+            merged.weights.y += c[i].weights.y;
+            if (w > 0.0 && random() * merged.weights.x < w) { merged.point = c[i].point; merged.normal = c[i].normal; merged.radiance = c[i].radiance; }
+        }
+        float target = gi_target(g, merged);
+        merged.weights.z = target > 0.0 ? merged.weights.x / target : 0.0;
+        r = merged;
+    }
+    final_gi_reservoirs[index] = r;
+}
+)";
 
-        glUniform1f(timeLoc, time);
-        glUniform3fv(cameraPosLoc, 1, glm::value_ptr(cam_pos));
-        glUniformMatrix4fv(cameraViewLoc, 1, GL_FALSE, glm::value_ptr(view_matrix));
+// Caustic photons of one pass. Every photon starts at a light (an emissive sphere, or the sky)
+// aimed at a specular sphere, since only paths through one end up in the caustic map, and is
+// stored at the first diffuse surface it reaches after one or more specular bounces.
+const std::string photonTraceShaderSource = std::string(tracerCommonSource) + R"(
+layout (local_size_x = 64) in;
+uniform uint u_photon_count; // photons emitted this pass
+const float SKY_DISTANCE = 100.0; // where sky photons start, outside any benchmark scene
 
-        glBindVertexArray(VAO_quad);
-        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-        glBindVertexArray(0);
+bool is_caster(int i) { return objects[i].type == 0 && is_specular(materials[objects[i].materialIndex]); }
 
-        SDL_GL_SwapWindow(window);
+// Solid-angle density of the emitted direction w from y: a caster is picked uniformly and w
+// uniformly in the cone it subtends, so every cone containing w adds to it.
+float cone_pdf(vec3 y, vec3 w, int casters) {
+    float pdf = 0.0;
+    for (int i = 0; i < objects.length(); ++i) {
+        if (!is_caster(i)) continue;
+        vec3 to_center = objects[i].modelMatrix[3].xyz - y;
+        float d2 = dot(to_center, to_center), s = objects[i].radius * objects[i].radius / d2;
+        if (s >= 1.0) continue;
+        float one_minus_cos_max = s / (1.0 + sqrt(1.0 - s));
+        if (dot(w, to_center) * inversesqrt(d2) >= 1.0 - one_minus_cos_max) pdf += 1.0 / (2.0 * PI * one_minus_cos_max * float(casters));
     }
+    return pdf;
+}
 
-    // Cleanup
-    glDeleteVertexArrays(1, &VAO_quad); glDeleteBuffers(1, &VBO_quad);
-    glDeleteProgram(shaderProgram); glDeleteBuffers(1, &object_ssbo);
-    glDeleteBuffers(1, &material_ssbo);
-    SDL_GL_DeleteContext(context); SDL_DestroyWindow(window); SDL_Quit();
+// Density of a sky photon per unit solid angle and unit area across its direction w: a
+// caster is picked uniformly, w uniformly over the sphere and the ray's offset uniformly in
+// the caster's silhouette disc, so every disc the ray passes through adds to it.
+float disc_pdf(Ray r, int casters) {
+    float pdf = 0.0;
+    for (int i = 0; i < objects.length(); ++i) {
+        if (!is_caster(i)) continue;
+        vec3 to_center = objects[i].modelMatrix[3].xyz - r.origin;
+        vec3 offset = to_center - dot(to_center, r.direction) * r.direction;
+        if (dot(offset, offset) < objects[i].radius * objects[i].radius) pdf += 1.0 / (PI * objects[i].radius * objects[i].radius * float(casters) * 4.0 * PI);
+    }
+    return pdf;
+}
 
-    return 0;
+void main() {
+    if (gl_GlobalInvocationID.x >= u_photon_count) return;
+    init_random(uvec2(gl_GlobalInvocationID.x, 0u), 0x7F4A7C15u);
+    int casters = 0;
+    for (int i = 0; i < objects.length(); ++i) if (is_caster(i)) ++casters;
+    int sources = lights.length() + (sky.x > 0.0 ? 1 : 0);
+    if (casters == 0 || sources == 0) return;
+    int caster = min(int(random() * float(casters)), casters - 1);
+    for (int i = 0; i < objects.length(); ++i) if (is_caster(i) && caster-- == 0) { caster = i; break; }
+    vec3 center = objects[caster].modelMatrix[3].xyz;
+    float radius = objects[caster].radius;
+    int source = min(int(random() * float(sources)), sources - 1);
+
+    Ray r; vec3 power;
+    if (source < lights.length()) {
+        // A uniform point on the light and a direction into the caster's cone.
+        vec3 n = normalize(random_in_unit_sphere() + vec3(0.0, 1e-6, 0.0));
+        vec3 y = lights[source].position.xyz + lights[source].position.w * n;
+        vec3 to_center = center - y;
+        float d2 = dot(to_center, to_center), s = radius * radius / d2;
+        if (s >= 1.0) return;
+        float one_minus_cos_max = s / (1.0 + sqrt(1.0 - s));
+        float cos_t = 1.0 - random() * one_minus_cos_max, sin_t = sqrt(max(1.0 - cos_t * cos_t, 0.0)), phi = 2.0 * PI * random();
+        vec3 w = to_center * inversesqrt(d2);
+        vec3 u = normalize(cross(abs(w.x) > 0.9 ? vec3(0.0, 1.0, 0.0) : vec3(1.0, 0.0, 0.0), w)), v = cross(w, u);
+        r = Ray(y, (u * cos(phi) + v * sin(phi)) * sin_t + w * cos_t);
+        float cos_y = dot(n, r.direction), pdf = cone_pdf(y, r.direction, casters);
+        if (cos_y <= 0.0 || pdf <= 0.0) return; // pdf: rounding at the cone's edge
+        float area = 4.0 * PI * lights[source].position.w * lights[source].position.w;
+        power = lights[source].color.rgb * cos_y * area / pdf;
+    } else {
+        // A uniform direction and a uniform offset across the caster's silhouette.
+        vec3 w = normalize(random_in_unit_sphere() + vec3(0.0, 1e-6, 0.0));
+        vec3 u = normalize(cross(abs(w.x) > 0.9 ? vec3(0.0, 1.0, 0.0) : vec3(1.0, 0.0, 0.0), w)), v = cross(w, u);
+        float rho = radius * sqrt(random()), phi = 2.0 * PI * random();
+        r = Ray(center + (u * cos(phi) + v * sin(phi)) * rho - w * SKY_DISTANCE, w);
+        float pdf = disc_pdf(r, casters);
+        if (pdf <= 0.0) return;
+        power = background(-w) / pdf;
+    }
+    power *= float(sources) / float(u_photon_count);
+
+    bool specular = false;
+    for (int depth = 0; depth < MAX_DEPTH; ++depth) {
+        HitInfo hit = intersect_scene(r);
+        if (!hit.is_hit) return;
+        MaterialData mat = materials[hit.materialIndex];
+        if (mat.type == MAT_LAMBERTIAN) { if (specular) photon_store(hit.point, hit.normal, power); return; }
+        vec3 attenuation; Ray scattered;
+        if (!scatter(r, hit, attenuation, scattered)) return;
+        power *= attenuation; r = scattered; specular = true;
+    }
+}
+)";
+
+// Folds the samples added to each radiance cache cell during a pass into its running mean,
+// which fades out samples older than about CACHE_HISTORY. Runs over the dirty slots only.
+const std::string cacheResolveShaderSource = shaderPreambleSource + R"(
+layout (local_size_x = 256) in;
+layout(std430, binding = 3) buffer CacheBuffer { uint cache_keys[CACHE_ENTRIES]; uvec4 cache_accum[CACHE_ENTRIES]; vec4 cache_radiance[CACHE_ENTRIES]; };
+layout(std430, binding = 6) buffer CacheDirtyBuffer { uvec4 cache_dirty_dispatch; uint cache_dirty[]; };
+const float CACHE_HISTORY = 4096.0;
+void main() {
+    if (gl_GlobalInvocationID.x >= cache_dirty_dispatch.w) return;
+    uint i = cache_dirty[gl_GlobalInvocationID.x];
+    uvec4 sums = cache_accum[i];
+    float n = float(min(sums.w, CACHE_MAX_PASS_SAMPLES));
+    vec4 old = cache_radiance[i];
+    float w = clamp(CACHE_HISTORY - n, 0.0, old.a);
+    cache_radiance[i] = vec4((old.rgb * w + vec3(sums.xyz) / CACHE_SCALE) / (w + n), w + n);
+    cache_accum[i] = uvec4(0u);
+}
+)";
+
+const char* displayShaderSource = R"(
+#version 430 core
+out vec4 FragColor;
+in vec2 TexCoords;
+
+uniform sampler2D u_accum;
+
+void main() {
+    vec4 accum = texture(u_accum, TexCoords);
+    vec3 color = accum.a > 0.0 ? accum.rgb / accum.a : vec3(0.0);
+
+    color = pow(color, vec3(1.0/2.2));
+    FragColor = vec4(color, 1.0);
+}
+)";
+
+// Starts a finer refinement level from a coarser one: the coarse mean, bilinearly
+// upsampled, counted as a single sample.
+const char* refineShaderSource = R"(
+#version 430 core
+out vec4 FragColor;
+in vec2 TexCoords;
+
+uniform sampler2D u_accum;
+
+void main() {
+    vec4 accum = texture(u_accum, TexCoords);
+    FragColor = accum.a > 0.0 ? vec4(accum.rgb / accum.a, 1.0) : vec4(0.0);
+}
+)";
+
+// Edge-adaptive upscaling in the manner of FSR 1's EASU. Each output pixel is filtered from
+// the 12 input texels around it:
+//     b c
+//   e f g h
+//   i j k l
+//     n o
+// Luma gradients of the four 2x2 quads around the sample point, weighted bilinearly, give
+// an edge direction and how strongly the neighbourhood is an edge. The kernel is a windowed
+// approximation of Lanczos-2, stretched along the edge and narrowed across it; the result
+// is clamped to the nearest four texels so that it cannot ring. The input is tone-mapped
+// and display-encoded.
+const char* easuShaderSource = R"(
+#version 430 core
+out vec4 FragColor;
+
+uniform sampler2D u_input;
+uniform vec2 u_output_size;
+
+ivec2 input_max;
+vec3 tap(ivec2 p) { return texelFetch(u_input, clamp(p, ivec2(0), input_max), 0).rgb; }
+float luma(vec3 c) { return c.b * 0.5 + (c.r * 0.5 + c.g); }
+
+// Accumulates direction and edge length from one quad: a above, b c d across, e below c.
+void analyse(inout vec2 dir, inout float len, float w, float la, float lb, float lc, float ld, float le) {
+    float dc = ld - lc, cb = lc - lb;
+    float dir_x = ld - lb;
+    float len_x = clamp(abs(dir_x) / max(max(abs(dc), abs(cb)), 1e-5), 0.0, 1.0);
+    dir.x += dir_x * w; len += len_x * len_x * w;
+    float ec = le - lc, ca = lc - la;
+    float dir_y = le - la;
+    float len_y = clamp(abs(dir_y) / max(max(abs(ec), abs(ca)), 1e-5), 0.0, 1.0);
+    dir.y += dir_y * w; len += len_y * len_y * w;
+}
+
+void accumulate(inout vec3 sum, inout float weight, vec2 offset, vec2 dir, vec2 len, float lobe, float clip, vec3 c) {
+    vec2 v = vec2(offset.x * dir.x + offset.y * dir.y, offset.x * -dir.y + offset.y * dir.x) * len; // rotated into the edge frame, scaled
+    float d2 = min(dot(v, v), clip);
+    // (25/16 (2/5 x^2 - 1)^2 - (25/16 - 1)) (lobe x^2 - 1)^2 approximates Lanczos-2 up to x = 2.
+    float base = 0.4 * d2 - 1.0, window = lobe * d2 - 1.0;
+    float w = (25.0 / 16.0 * base * base - (25.0 / 16.0 - 1.0)) * (window * window);
+    sum += c * w; weight += w;
+}
+
+void main() {
+    ivec2 input_size = textureSize(u_input, 0); input_max = input_size - 1;
+    vec2 pp = gl_FragCoord.xy * vec2(input_size) / u_output_size - 0.5;
+    ivec2 fp = ivec2(floor(pp)); pp -= floor(pp);
+    vec3 b = tap(fp + ivec2(0, -1)), c = tap(fp + ivec2(1, -1));
+    vec3 e = tap(fp + ivec2(-1, 0)), f = tap(fp), g = tap(fp + ivec2(1, 0)), h = tap(fp + ivec2(2, 0));
+    vec3 i = tap(fp + ivec2(-1, 1)), j = tap(fp + ivec2(0, 1)), k = tap(fp + ivec2(1, 1)), l = tap(fp + ivec2(2, 1));
+    vec3 n = tap(fp + ivec2(0, 2)), o = tap(fp + ivec2(1, 2));
+    float bL = luma(b), cL = luma(c), eL = luma(e), fL = luma(f), gL = luma(g), hL = luma(h);
+    float iL = luma(i), jL = luma(j), kL = luma(k), lL = luma(l), nL = luma(n), oL = luma(o);
+
+    vec2 dir = vec2(0.0); float len = 0.0;
+    analyse(dir, len, (1.0 - pp.x) * (1.0 - pp.y), bL, eL, fL, gL, jL);
+    analyse(dir, len, pp.x * (1.0 - pp.y), cL, fL, gL, hL, kL);
+    analyse(dir, len, (1.0 - pp.x) * pp.y, fL, iL, jL, kL, nL);
+    analyse(dir, len, pp.x * pp.y, gL, jL, kL, lL, oL);
+    float dir_r = dot(dir, dir);
+    dir = dir_r < 1.0 / 32768.0 ? vec2(1.0, 0.0) : dir * inversesqrt(dir_r);
+    len = len * 0.5; len *= len;
+    // Diagonal edges stretch the kernel further than axis-aligned ones.
+    float stretch = dot(dir, dir) / max(abs(dir.x), abs(dir.y));
+    vec2 len2 = vec2(1.0 + (stretch - 1.0) * len, 1.0 - 0.5 * len);
+    float lobe = 0.5 + ((1.0 / 4.0 - 0.04) - 0.5) * len;
+    float clip = 1.0 / lobe;
+
+    vec3 sum = vec3(0.0); float weight = 0.0;
+    accumulate(sum, weight, vec2(0.0, -1.0) - pp, dir, len2, lobe, clip, b);
+    accumulate(sum, weight, vec2(1.0, -1.0) - pp, dir, len2, lobe, clip, c);
+    accumulate(sum, weight, vec2(-1.0, 1.0) - pp, dir, len2, lobe, clip, i);
+    accumulate(sum, weight, vec2(0.0, 1.0) - pp, dir, len2, lobe, clip, j);
+    accumulate(sum, weight, vec2(0.0, 0.0) - pp, dir, len2, lobe, clip, f);
+    accumulate(sum, weight, vec2(-1.0, 0.0) - pp, dir, len2, lobe, clip, e);
+    accumulate(sum, weight, vec2(1.0, 1.0) - pp, dir, len2, lobe, clip, k);
+    accumulate(sum, weight, vec2(2.0, 1.0) - pp, dir, len2, lobe, clip, l);
+    accumulate(sum, weight, vec2(2.0, 0.0) - pp, dir, len2, lobe, clip, h);
+    accumulate(sum, weight, vec2(1.0, 0.0) - pp, dir, len2, lobe, clip, g);
+    accumulate(sum, weight, vec2(1.0, 2.0) - pp, dir, len2, lobe, clip, o);
+    accumulate(sum, weight, vec2(0.0, 2.0) - pp, dir, len2, lobe, clip, n);
+    vec3 lo = min(min(f, g), min(j, k)), hi = max(max(f, g), max(j, k));
+    FragColor = vec4(clamp(sum / weight, lo, hi), 1.0);
+}
+)";
+
+// Contrast-adaptive sharpening in the manner of FSR 1's RCAS: a cross-shaped kernel with a
+// negative lobe as strong as possible without pushing any channel of the centre pixel
+// outside the range of its four neighbours, so it cannot clip or ring. Less is applied
+// where the luma looks like noise rather than an edge, which matters for a path tracer's
+// early samples. u_sharpness is exp2(-stops); 1 is the strongest.
+const char* rcasShaderSource = R"(
+#version 430 core
+out vec4 FragColor;
+
+uniform sampler2D u_input;
+uniform float u_sharpness;
+
+const float RCAS_LIMIT = 0.25 - 1.0 / 16.0;
+
+float luma(vec3 c) { return c.b * 0.5 + (c.r * 0.5 + c.g); }
+
+void main() {
+    ivec2 p = ivec2(gl_FragCoord.xy), hi = textureSize(u_input, 0) - 1;
+    //   b
+    // d e f
+    //   h
+    vec3 b = texelFetch(u_input, clamp(p + ivec2(0, -1), ivec2(0), hi), 0).rgb;
+    vec3 d = texelFetch(u_input, clamp(p + ivec2(-1, 0), ivec2(0), hi), 0).rgb;
+    vec3 e = texelFetch(u_input, p, 0).rgb;
+    vec3 f = texelFetch(u_input, clamp(p + ivec2(1, 0), ivec2(0), hi), 0).rgb;
+    vec3 h = texelFetch(u_input, clamp(p + ivec2(0, 1), ivec2(0), hi), 0).rgb;
+    float bL = luma(b), dL = luma(d), eL = luma(e), fL = luma(f), hL = luma(h);
+    float range = max(max(max(bL, dL), max(eL, fL)), hL) - min(min(min(bL, dL), min(eL, fL)), hL);
+    float noise = clamp(abs(0.25 * (bL + dL + fL + hL) - eL) / max(range, 1e-5), 0.0, 1.0);
+    vec3 lo = min(min(b, d), min(f, h)), hi4 = max(max(b, d), max(f, h));
+    vec3 hit_min = lo / max(4.0 * hi4, 1e-5);
+    vec3 hit_max = (1.0 - hi4) / min(4.0 * lo - 4.0, -1e-5);
+    vec3 lobes = max(-hit_min, hit_max);
+    float lobe = max(-RCAS_LIMIT, min(max(lobes.r, max(lobes.g, lobes.b)), 0.0)) * u_sharpness;
+    lobe *= 1.0 - 0.5 * noise;
+    FragColor = vec4(clamp((lobe * (b + d + f + h) + e) / (4.0 * lobe + 1.0), 0.0, 1.0), 1.0);
+}
+)";
+
+// Temporal upsampling: each frame traces one jittered sample per pixel at render resolution
+// (u_input, with the primary hit points in u_positions), and this pass folds it into a
+// history at output resolution. An output pixel takes the input samples around it weighted
+// by a Gaussian of their distance in output pixels, as the jitter moves them over the
+// frames. The history is reprojected with the motion of the nearest surface among those
+// samples, sampled with Catmull-Rom and clipped to the samples' neighbourhood in YCoCg, and
+// its weight is capped so that it follows changes. While the camera stands still the
+// history is neither reprojected nor clipped, and accumulates without limit. Both images
+// hold sums, alpha holding the sample count or weight. Built on the tracer's code for its
+// camera model (project_to_screen()) and u_jitter.
+const std::string taauShaderSource = std::string(tracerCommonSource) + R"(
+out vec4 FragColor;
+
+uniform sampler2D u_input;
+uniform sampler2D u_positions;
+uniform sampler2D u_history;
+uniform mat4 u_view, u_prev_view;
+uniform vec3 u_camera_position;
+uniform int u_history_valid;
+uniform int u_camera_moved;
+
+const float MOVING_HISTORY = 16.0; // weight cap while the camera moves, about that many frames
+const float CLIP_SIGMAS = 1.25;
+
+vec3 to_ycocg(vec3 c) { return vec3(0.25 * c.r + 0.5 * c.g + 0.25 * c.b, 0.5 * c.r - 0.5 * c.b, -0.25 * c.r + 0.5 * c.g - 0.25 * c.b); }
+vec3 from_ycocg(vec3 c) { return vec3(c.x + c.y - c.z, c.x + c.z, c.x - c.y - c.z); }
+
+// Catmull-Rom in five bilinear taps, leaving out the corners.
+vec4 catmull_rom(sampler2D tex, vec2 uv) {
+    vec2 size = vec2(textureSize(tex, 0)), position = uv * size;
+    vec2 centre = floor(position - 0.5) + 0.5, f = position - centre;
+    vec2 w0 = f * (-0.5 + f * (1.0 - 0.5 * f)), w1 = 1.0 + f * f * (-2.5 + 1.5 * f);
+    vec2 w2 = f * (0.5 + f * (2.0 - 1.5 * f)), w3 = f * f * (-0.5 + 0.5 * f);
+    vec2 w12 = w1 + w2;
+    vec2 t0 = (centre - 1.0) / size, t3 = (centre + 2.0) / size, t12 = (centre + w2 / w12) / size;
+    vec4 sum = texture(tex, vec2(t12.x, t0.y)) * (w12.x * w0.y) + texture(tex, vec2(t0.x, t12.y)) * (w0.x * w12.y)
+             + texture(tex, t12) * (w12.x * w12.y)
+             + texture(tex, vec2(t3.x, t12.y)) * (w3.x * w12.y) + texture(tex, vec2(t12.x, t3.y)) * (w12.x * w3.y);
+    return sum / (w12.x * w0.y + w0.x * w12.y + w12.x * w12.y + w3.x * w12.y + w12.x * w3.y);
+}
+
+void main() {
+    vec2 output_size = vec2(textureSize(u_history, 0));
+    ivec2 input_max = textureSize(u_input, 0) - 1;
+    vec2 scale = vec2(input_max + 1) / output_size; // input pixels per output pixel
+    vec2 p = gl_FragCoord.xy * scale;
+    ivec2 centre = ivec2(floor(p));
+
+    vec3 sum = vec3(0.0), m1 = vec3(0.0), m2 = vec3(0.0), point = vec3(0.0);
+    float weight = 0.0, nearest = 1e30;
+    for (int dy = -1; dy <= 1; ++dy) for (int dx = -1; dx <= 1; ++dx) {
+        ivec2 t = clamp(centre + ivec2(dx, dy), ivec2(0), input_max);
+        vec4 s = texelFetch(u_input, t, 0);
+        vec2 d = (vec2(t) + 0.5 + u_jitter - p) / scale;
+        float w = exp(-2.29 * dot(d, d)); // close to a Blackman-Harris window of radius 1
+        sum += s.rgb * w; weight += s.a * w;
+        vec3 y = to_ycocg(s.a > 0.0 ? s.rgb / s.a : vec3(0.0));
+        m1 += y; m2 += y * y;
+        vec4 position = texelFetch(u_positions, t, 0);
+        vec3 hit = position.w > 0.0 ? position.xyz / position.w : u_camera_position + vec3(0.0, 0.0, 1e4);
+        float distance = length(hit - u_camera_position);
+        if (distance < nearest) { nearest = distance; point = hit; }
+    }
+
+    vec4 history = vec4(0.0);
+    if (u_history_valid != 0 && u_camera_moved == 0) history = texelFetch(u_history, ivec2(gl_FragCoord.xy), 0);
+    else if (u_history_valid != 0) {
+        float aspect_ratio = output_size.x / output_size.y;
+        vec2 uv = gl_FragCoord.xy / output_size + project_to_screen(u_prev_view, point, aspect_ratio) - project_to_screen(u_view, point, aspect_ratio);
+        if ((u_prev_view * vec4(point, 1.0)).z < 0.0 && all(greaterThanEqual(uv, vec2(0.0))) && all(lessThanEqual(uv, vec2(1.0)))) {
+            history = max(catmull_rom(u_history, uv), vec4(0.0));
+            if (history.a > 0.0) {
+                vec3 mean = m1 / 9.0, sigma = sqrt(max(m2 / 9.0 - mean * mean, vec3(0.0)));
+                vec3 clipped = from_ycocg(clamp(to_ycocg(history.rgb / history.a), mean - CLIP_SIGMAS * sigma, mean + CLIP_SIGMAS * sigma));
+                float w = min(history.a, MOVING_HISTORY);
+                history = vec4(max(clipped, vec3(0.0)) * w, w);
+            }
+        }
+    }
+    FragColor = history + vec4(sum, weight);
+}
+)";
+
+
+// --- Heap Accounting ---
+// Counts every operator new of the process, and of each thread, so the viewer can check
+// that its render loop has reached a steady state that never touches the heap. The GL
+// driver and SDL allocate with malloc and are not counted.
+std::atomic<uint64_t> g_heap_allocations{0};
+thread_local uint64_t t_heap_allocations = 0;
+void* operator new(size_t size) {
+    g_heap_allocations.fetch_add(1, std::memory_order_relaxed); ++t_heap_allocations;
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+// Over-aligned types (alignas beyond max_align_t) come through the align_val_t overloads.
+void* operator new(size_t size, std::align_val_t align) {
+    g_heap_allocations.fetch_add(1, std::memory_order_relaxed); ++t_heap_allocations;
+    const size_t a = std::max((size_t)align, sizeof(void*));
+    if (void* p = std::aligned_alloc(a, (std::max<size_t>(size, 1) + a - 1) & ~(a - 1))) return p;
+    throw std::bad_alloc();
+}
+// The array and nothrow forms forward to these. Not inlined, or GCC sees free() called on
+// memory from operator new.
+__attribute__((noinline)) void operator delete(void* p) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete(void* p, size_t, std::align_val_t) noexcept { std::free(p); }
+
+
+// --- Frame Arenas ---
+// Per-frame transient data (camera uploads, scene upload staging, input records, guiding
+// logs in training) is bump-allocated from an arena owned by the thread, instead of the heap.
+// For the CPU thread pool's workers one parallelFor() job is the frame: they reset their
+// arena after each.
+// ArenaScope rewinds the arena when it goes out of scope, so code that runs outside a frame
+// loop stays bounded too. At a frame boundary, when nothing allocated from it is alive,
+// reset() rewinds completely and folds any chunks added during the frame into one chunk
+// large enough for the frame. From then on a frame of the same shape allocates nothing.
+class FrameArena {
+public:
+    struct Stats { uint64_t allocations = 0, chunk_allocations = 0, resets = 0; size_t frame_bytes = 0, peak_bytes = 0, capacity = 0; };
+    explicit FrameArena(size_t first_chunk = 64 << 10) : first_chunk(first_chunk) {}
+    FrameArena(const FrameArena&) = delete; FrameArena& operator=(const FrameArena&) = delete;
+    ~FrameArena() { for (Chunk& c : chunks) std::free(c.data); }
+    void* allocate(size_t bytes, size_t align) {
+        ++stats.allocations;
+        while (true) {
+            if (current < chunks.size()) {
+                size_t offset = (used + align - 1) & ~(align - 1);
+                if (offset + bytes <= chunks[current].size) {
+                    used = offset + bytes;
+                    stats.frame_bytes = std::max(stats.frame_bytes, base + used);
+                    return chunks[current].data + offset;
+                }
+                if (current + 1 < chunks.size()) { base += chunks[current].size; ++current; used = 0; continue; }
+            }
+            addChunk(std::max(chunks.empty() ? first_chunk : chunks.back().size * 2, bytes + align));
+        }
+    }
+    struct Mark { size_t chunk, used, base; };
+    Mark mark() const { return {current, used, base}; }
+    void rewind(const Mark& m) { current = m.chunk; used = m.used; base = m.base; }
+    void reset() {
+        ++stats.resets;
+        stats.peak_bytes = std::max(stats.peak_bytes, stats.frame_bytes);
+        if (chunks.size() > 1) {
+            size_t total = 0;
+            for (Chunk& c : chunks) { total += c.size; std::free(c.data); }
+            chunks.clear();
+            addChunk(total);
+        }
+        current = 0; used = 0; base = 0; stats.frame_bytes = 0;
+    }
+    const Stats& statistics() const { return stats; }
+private:
+    struct Chunk { char* data; size_t size; };
+    // At most one chunk per doubling, so the list is reserved once.
+    void addChunk(size_t size) {
+        if (chunks.capacity() == 0) chunks.reserve(48);
+        Chunk c{(char*)std::malloc(size), size};
+        if (!c.data) throw std::bad_alloc();
+        ++stats.chunk_allocations; stats.capacity += size;
+        if (!chunks.empty()) base += chunks[current].size;
+        chunks.push_back(c); current = chunks.size() - 1; used = 0;
+    }
+    std::vector<Chunk> chunks; size_t first_chunk, current = 0, used = 0, base = 0; // base: bytes in the chunks before current
+    Stats stats;
+};
+
+// The calling thread's arena.
+FrameArena& threadArena() { thread_local FrameArena arena; return arena; }
+
+class ArenaScope {
+public:
+    explicit ArenaScope(FrameArena& arena = threadArena()) : arena(arena), saved(arena.mark()) {}
+    ~ArenaScope() { arena.rewind(saved); }
+private:
+    FrameArena& arena; FrameArena::Mark saved;
+};
+
+// Standard allocator over an arena; deallocation is a no-op. Defaults to the calling thread's.
+template <typename T> struct ArenaAllocator {
+    using value_type = T;
+    FrameArena* arena;
+    ArenaAllocator() : arena(&threadArena()) {}
+    explicit ArenaAllocator(FrameArena& arena) : arena(&arena) {}
+    template <typename U> ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+    T* allocate(size_t n) { return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T))); }
+    void deallocate(T*, size_t) {}
+    template <typename U> bool operator==(const ArenaAllocator<U>& other) const { return arena == other.arena; }
+    template <typename U> bool operator!=(const ArenaAllocator<U>& other) const { return arena != other.arena; }
+};
+template <typename T> using FrameVector = std::vector<T, ArenaAllocator<T>>;
+
+
+// --- CPU Data Structures ---
+enum MaterialType { MAT_LAMBERTIAN = 0, MAT_METAL = 1, MAT_GLASS = 2, MAT_EMISSIVE = 3 };
+struct MaterialData { glm::vec4 baseColor; glm::vec4 properties; glm::vec4 emission; int type; int _padding[3]; };
+struct ObjectData { glm::mat4 modelMatrix; glm::mat4 inverseModelMatrix; int materialIndex; int type; float radius; float _padding; glm::vec3 halfSize; float _padding2; };
+struct LightData { glm::vec4 position; glm::vec4 color; };
+enum Projection { PROJ_PINHOLE = 0, PROJ_EQUIRECT = 1, PROJ_CUBE_FACE = 2 };
+enum DirectLighting { DIRECT_BSDF = 0, DIRECT_NEE = 1, DIRECT_RESTIR = 2 };
+enum Caustics { CAUSTICS_PATH = 0, CAUSTICS_PHOTONS = 1, CAUSTICS_PROGRESSIVE = 2 };
+enum Preview { PREVIEW_NONE = 0, PREVIEW_SHADED = 1, PREVIEW_AO = 2, PREVIEW_DIRECT = 3 };
+enum Traversal { TRAVERSAL_SCANLINE = 0, TRAVERSAL_MORTON = 1, TRAVERSAL_HILBERT = 2 };
+enum Upscale { UPSCALE_BILINEAR = 0, UPSCALE_EASU = 1, UPSCALE_TAAU = 2 };
+const char* const TRAVERSAL_NAMES[] = {"scanline", "morton", "hilbert"};
+struct CameraData { glm::mat4 inverseView; glm::vec4 position; int projection; int face; float _padding[2]; };
+struct Material { std::string name; MaterialType type; glm::vec3 color; glm::vec3 emission; float metallic; float roughness; float ior; };
+
+class SceneObject {
+public:
+    int id; glm::vec3 position; glm::mat4 rotation; int materialId;
+    SceneObject(int matId) : id(-1), position(0.0f), rotation(1.0f), materialId(matId) {}
+    virtual ~SceneObject() = default;
+    glm::mat4 getModelMatrix() const { return glm::translate(glm::mat4(1.0f), position) * rotation; }
+    virtual ObjectData getGPUData() const = 0;
+};
+class Sphere : public SceneObject {
+public:
+    float radius;
+    Sphere(glm::vec3 pos, float r, int matId) : SceneObject(matId), radius(r) { position = pos; }
+    ObjectData getGPUData() const override { ObjectData d{}; d.modelMatrix = getModelMatrix(); d.inverseModelMatrix = glm::inverse(d.modelMatrix); d.materialIndex = materialId; d.type = 0; d.radius = radius; return d; }
+};
+// ADDED CLASS FOR PLANE
+class Plane : public SceneObject {
+public:
+    Plane(glm::vec3 pos, int matId) : SceneObject(matId) { position = pos; }
+    ObjectData getGPUData() const override { ObjectData d{}; d.modelMatrix = getModelMatrix(); d.inverseModelMatrix = glm::inverse(d.modelMatrix); d.materialIndex = materialId; d.type = 2; return d; }
+};
+class Scene {
+public:
+    std::vector<SceneObject*> objects; std::vector<Material> materials;
+    float sky = 1.0f; // scale of the background radiance
+    ~Scene() { for (auto obj : objects) delete obj; }
+    int addMaterial(const Material& mat) { materials.push_back(mat); return materials.size() - 1; }
+    void addObject(SceneObject* obj) { obj->id = objects.size(); objects.push_back(obj); }
+    // The fill overloads append to any vector, so per-frame uploads can stage in a FrameVector.
+    template <typename Vec> void getObjectGPUData(Vec& data) const { for (const auto& obj : objects) data.push_back(obj->getGPUData()); }
+    template <typename Vec> void getMaterialGPUData(Vec& data) const {
+        for (const auto& mat : materials) { MaterialData d{}; d.baseColor=glm::vec4(mat.color,1); d.emission=glm::vec4(mat.emission,1); d.properties=glm::vec4(mat.metallic, mat.roughness, mat.ior,0); d.type=mat.type; data.push_back(d); }
+    }
+    // Emissive spheres: the lights that NEE and ReSTIR sample explicitly.
+    template <typename Vec> void getLightGPUData(Vec& data) const {
+        for (const auto& obj : objects) { const Sphere* s = dynamic_cast<const Sphere*>(obj); if (s && materials[obj->materialId].type == MAT_EMISSIVE) data.push_back({glm::vec4(s->position, s->radius), glm::vec4(materials[obj->materialId].emission, (float)obj->id)}); }
+    }
+    std::vector<ObjectData> getObjectGPUData() const { std::vector<ObjectData> data; getObjectGPUData(data); return data; }
+    std::vector<MaterialData> getMaterialGPUData() const { std::vector<MaterialData> data; getMaterialGPUData(data); return data; }
+    std::vector<LightData> getLightGPUData() const { std::vector<LightData> data; getLightGPUData(data); return data; }
+};
+
+struct Camera {
+    glm::vec3 position; glm::vec3 target;
+    glm::mat4 view() const { return glm::lookAt(position, target, glm::vec3(0, 1, 0)); }
+};
+
+// --- Scenes ---
+void buildDefaultScene(Scene& scene) {
+    int ground_mat_id = scene.addMaterial({"Ground", MAT_LAMBERTIAN, {0.5f, 0.5f, 0.5f}, {}, 0.0f, 1.0f, 1.0f});
+    int center_mat_id = scene.addMaterial({"Center", MAT_GLASS, {1.0f, 1.0f, 1.0f}, {}, 0.0f, 0.0f, 1.52f});
+    int left_mat_id = scene.addMaterial({"Left Metal", MAT_METAL, {0.8f, 0.8f, 0.8f}, {}, 1.0f, 0.0f, 1.0f});
+    int right_mat_id = scene.addMaterial({"Right Metal", MAT_METAL, {0.8f, 0.6f, 0.2f}, {}, 1.0f, 0.3f, 1.0f});
+
+    scene.addObject(new Plane({0.0f, -0.5f, 0.0f}, ground_mat_id));
+    scene.addObject(new Sphere({0.0f, 0.0f, 0.0f}, 0.5f, center_mat_id));
+    scene.addObject(new Sphere({-1.2f, 0.0f, 0.0f}, 0.5f, left_mat_id));
+    scene.addObject(new Sphere({1.2f, 0.0f, 0.0f}, 0.5f, right_mat_id));
+}
+
+// Indirect-heavy: only diffuse surfaces, lit by the sky through several bounces.
+void buildDiffuseScene(Scene& scene) {
+    int ground_mat_id = scene.addMaterial({"Ground", MAT_LAMBERTIAN, {0.7f, 0.7f, 0.7f}, {}, 0.0f, 1.0f, 1.0f});
+    int red_mat_id = scene.addMaterial({"Red", MAT_LAMBERTIAN, {0.8f, 0.2f, 0.2f}, {}, 0.0f, 1.0f, 1.0f});
+    int green_mat_id = scene.addMaterial({"Green", MAT_LAMBERTIAN, {0.2f, 0.8f, 0.3f}, {}, 0.0f, 1.0f, 1.0f});
+    int white_mat_id = scene.addMaterial({"White", MAT_LAMBERTIAN, {0.9f, 0.9f, 0.9f}, {}, 0.0f, 1.0f, 1.0f});
+
+    scene.addObject(new Plane({0.0f, -0.5f, 0.0f}, ground_mat_id));
+    scene.addObject(new Sphere({0.0f, 0.5f, 0.0f}, 1.0f, white_mat_id));
+    scene.addObject(new Sphere({-1.3f, -0.1f, 0.6f}, 0.4f, red_mat_id));
+    scene.addObject(new Sphere({1.3f, -0.1f, 0.6f}, 0.4f, green_mat_id));
+}
+
+// Specular chains: glass in front of diffuse and metal spheres.
+void buildGlassScene(Scene& scene) {
+    int ground_mat_id = scene.addMaterial({"Ground", MAT_LAMBERTIAN, {0.6f, 0.6f, 0.5f}, {}, 0.0f, 1.0f, 1.0f});
+    int glass_mat_id = scene.addMaterial({"Glass", MAT_GLASS, {1.0f, 1.0f, 1.0f}, {}, 0.0f, 0.0f, 1.52f});
+    int blue_mat_id = scene.addMaterial({"Blue", MAT_LAMBERTIAN, {0.2f, 0.3f, 0.8f}, {}, 0.0f, 1.0f, 1.0f});
+    int gold_mat_id = scene.addMaterial({"Gold", MAT_METAL, {0.9f, 0.7f, 0.3f}, {}, 1.0f, 0.1f, 1.0f});
+
+    scene.addObject(new Plane({0.0f, -0.5f, 0.0f}, ground_mat_id));
+    scene.addObject(new Sphere({0.0f, 0.0f, 1.0f}, 0.5f, glass_mat_id));
+    scene.addObject(new Sphere({0.7f, 0.0f, 0.0f}, 0.5f, glass_mat_id));
+    scene.addObject(new Sphere({-0.6f, -0.1f, -0.4f}, 0.4f, blue_mat_id));
+    scene.addObject(new Sphere({0.2f, 0.1f, -1.2f}, 0.6f, gold_mat_id));
+}
+
+// Many lights: a ring of small coloured emitters over diffuse spheres, under a dim sky.
+void buildLightsScene(Scene& scene) {
+    scene.sky = 0.05f;
+    int ground_mat_id = scene.addMaterial({"Ground", MAT_LAMBERTIAN, {0.6f, 0.6f, 0.6f}, {}, 0.0f, 1.0f, 1.0f});
+    int white_mat_id = scene.addMaterial({"White", MAT_LAMBERTIAN, {0.8f, 0.8f, 0.8f}, {}, 0.0f, 1.0f, 1.0f});
+    const glm::vec3 colors[4] = {{1.0f, 0.3f, 0.2f}, {0.3f, 1.0f, 0.4f}, {0.3f, 0.5f, 1.0f}, {1.0f, 0.9f, 0.6f}};
+    int light_mat_ids[4];
+    for (int i = 0; i < 4; ++i) light_mat_ids[i] = scene.addMaterial({"Light", MAT_EMISSIVE, {}, colors[i] * 40.0f, 0.0f, 1.0f, 1.0f});
+
+    scene.addObject(new Plane({0.0f, -0.5f, 0.0f}, ground_mat_id));
+    scene.addObject(new Sphere({0.0f, 0.1f, 0.0f}, 0.6f, white_mat_id));
+    scene.addObject(new Sphere({-1.4f, -0.15f, 0.5f}, 0.35f, white_mat_id));
+    scene.addObject(new Sphere({1.4f, -0.15f, 0.5f}, 0.35f, white_mat_id));
+    for (int i = 0; i < 32; ++i) {
+        float angle = 2.0f * 3.14159265f * i / 32.0f, radius = 2.2f + 0.4f * (i % 2);
+        scene.addObject(new Sphere({std::cos(angle) * radius, -0.2f + 0.3f * (i % 3), std::sin(angle) * radius}, 0.06f, light_mat_ids[i % 4]));
+    }
+}
+
+// Caustics: glass spheres on a diffuse floor under one small, bright light and a dim sky.
+void buildCausticsScene(Scene& scene) {
+    scene.sky = 0.05f;
+    int ground_mat_id = scene.addMaterial({"Ground", MAT_LAMBERTIAN, {0.7f, 0.7f, 0.7f}, {}, 0.0f, 1.0f, 1.0f});
+    int glass_mat_id = scene.addMaterial({"Glass", MAT_GLASS, {1.0f, 1.0f, 1.0f}, {}, 0.0f, 0.0f, 1.52f});
+    int gold_mat_id = scene.addMaterial({"Gold", MAT_METAL, {0.9f, 0.7f, 0.3f}, {}, 1.0f, 0.0f, 1.0f});
+    int light_mat_id = scene.addMaterial({"Light", MAT_EMISSIVE, {}, {400.0f, 380.0f, 340.0f}, 0.0f, 1.0f, 1.0f});
+
+    scene.addObject(new Plane({0.0f, -0.5f, 0.0f}, ground_mat_id));
+    scene.addObject(new Sphere({0.0f, 0.1f, 0.0f}, 0.6f, glass_mat_id));
+    scene.addObject(new Sphere({-1.2f, -0.2f, 0.7f}, 0.3f, glass_mat_id));
+    scene.addObject(new Sphere({1.3f, -0.1f, -0.3f}, 0.4f, gold_mat_id));
+    scene.addObject(new Sphere({-1.0f, 2.2f, -1.0f}, 0.1f, light_mat_id));
+}
+
+struct BenchmarkScene { const char* name; void (*build)(Scene&); Camera camera; };
+const BenchmarkScene BENCHMARK_SCENES[] = {
+    {"default", buildDefaultScene, {{4.0f, 1.5f, 0.0f}, {0.0f, 0.0f, 0.0f}}},
+    {"diffuse", buildDiffuseScene, {{0.0f, 1.2f, 4.5f}, {0.0f, 0.2f, 0.0f}}},
+    {"glass", buildGlassScene, {{2.5f, 1.2f, 3.0f}, {0.0f, 0.0f, 0.0f}}},
+    {"lights", buildLightsScene, {{0.0f, 2.0f, 4.5f}, {0.0f, 0.0f, 0.0f}}},
+    {"caustics", buildCausticsScene, {{0.5f, 1.8f, 3.8f}, {0.0f, -0.2f, 0.0f}}},
+};
+const BenchmarkScene* findBenchmarkScene(const std::string& name) { for (const auto& b : BENCHMARK_SCENES) if (name == b.name) return &b; return nullptr; }
+
+uint64_t hashBytes(const void* data, size_t size, uint64_t h = 1469598103934665603ull) { for (size_t i = 0; i < size; ++i) h = (h ^ ((const uint8_t*)data)[i]) * 1099511628211ull; return h; }
+// Identifies the image a set of samples belongs to: geometry, materials, viewpoint and, when
+// not the defaults, projection and sky. renderHash() adds the estimator.
+uint64_t sceneHash(const Scene& scene, const Camera& camera, Projection projection = PROJ_PINHOLE) {
+    std::vector<ObjectData> objects = scene.getObjectGPUData();
+    std::vector<MaterialData> materials = scene.getMaterialGPUData();
+    uint64_t h = hashBytes(objects.data(), objects.size() * sizeof(ObjectData));
+    h = hashBytes(materials.data(), materials.size() * sizeof(MaterialData), h);
+    h = hashBytes(&camera, sizeof(Camera), h);
+    if (scene.sky != 1.0f) h = hashBytes(&scene.sky, sizeof(scene.sky), h);
+    return projection == PROJ_PINHOLE ? h : hashBytes(&projection, sizeof(projection), h);
+}
+
+
+// --- Shader Compilation Functions ---
+void compileShader(GLuint shader, const std::string& type) { glCompileShader(shader); GLint success; glGetShaderiv(shader, GL_COMPILE_STATUS, &success); if (!success) { char infoLog[1024]; glGetShaderInfoLog(shader, 1024, NULL, infoLog); throw std::runtime_error("SHADER_COMPILATION_ERROR of type: " + type + "\n" + infoLog); } }
+GLuint createShaderProgram(const char* fsSource, const char* gsSource = nullptr) { GLuint vs = glCreateShader(GL_VERTEX_SHADER); glShaderSource(vs, 1, &vertexShaderSource, NULL); compileShader(vs, "VERTEX"); GLuint fs = glCreateShader(GL_FRAGMENT_SHADER); glShaderSource(fs, 1, &fsSource, NULL); compileShader(fs, "FRAGMENT"); GLuint gs = 0; if (gsSource) { gs = glCreateShader(GL_GEOMETRY_SHADER); glShaderSource(gs, 1, &gsSource, NULL); compileShader(gs, "GEOMETRY"); } GLuint prog = glCreateProgram(); glAttachShader(prog, vs); glAttachShader(prog, fs); if (gs) glAttachShader(prog, gs); glLinkProgram(prog); GLint success; glGetProgramiv(prog, GL_LINK_STATUS, &success); if (!success) { char infoLog[1024]; glGetProgramInfoLog(prog, 1024, NULL, infoLog); throw std::runtime_error("SHADER_PROGRAM_LINKING_ERROR\n" + std::string(infoLog)); } glDeleteShader(vs); glDeleteShader(fs); if (gs) glDeleteShader(gs); return prog; }
+GLuint createComputeProgram(const char* source) { GLuint cs = glCreateShader(GL_COMPUTE_SHADER); glShaderSource(cs, 1, &source, NULL); compileShader(cs, "COMPUTE"); GLuint prog = glCreateProgram(); glAttachShader(prog, cs); glLinkProgram(prog); GLint success; glGetProgramiv(prog, GL_LINK_STATUS, &success); if (!success) { char infoLog[1024]; glGetProgramInfoLog(prog, 1024, NULL, infoLog); throw std::runtime_error("SHADER_PROGRAM_LINKING_ERROR\n" + std::string(infoLog)); } glDeleteShader(cs); return prog; }
+
+
+// --- GPU Resources ---
+// version identifies one upload of scene data; bound_version is the one currently bound,
+// which tells per-scene state elsewhere (the radiance cache) when to start over.
+struct SceneBuffers {
+    GLuint object_ssbo = 0, material_ssbo = 0, light_ssbo = 0; uint32_t version = 0;
+    static inline uint32_t next_version = 0, bound_version = 0;
+    void upload(const Scene& scene) {
+        bound_version = version = ++next_version;
+        ArenaScope scope; // staging for the uploads below
+        FrameVector<ObjectData> object_gpu_data; object_gpu_data.reserve(scene.objects.size()); scene.getObjectGPUData(object_gpu_data);
+        FrameVector<MaterialData> material_gpu_data; material_gpu_data.reserve(scene.materials.size()); scene.getMaterialGPUData(material_gpu_data);
+        if (!object_ssbo) glGenBuffers(1, &object_ssbo);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, object_ssbo);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, object_gpu_data.size() * sizeof(ObjectData), object_gpu_data.data(), GL_DYNAMIC_DRAW);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, object_ssbo);
+        if (!material_ssbo) glGenBuffers(1, &material_ssbo);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, material_ssbo);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, material_gpu_data.size() * sizeof(MaterialData), material_gpu_data.data(), GL_STATIC_DRAW);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, material_ssbo);
+        // Light buffer: the sky scale in a vec4 header, then the lights.
+        FrameVector<LightData> light_gpu_data; scene.getLightGPUData(light_gpu_data);
+        FrameVector<glm::vec4> light_buffer; light_buffer.reserve(1 + 2 * light_gpu_data.size());
+        light_buffer.push_back(glm::vec4(scene.sky, 0.0f, 0.0f, 0.0f));
+        for (const LightData& l : light_gpu_data) { light_buffer.push_back(l.position); light_buffer.push_back(l.color); }
+        if (!light_ssbo) glGenBuffers(1, &light_ssbo);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, light_ssbo);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, light_buffer.size() * sizeof(glm::vec4), light_buffer.data(), GL_STATIC_DRAW);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, light_ssbo);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+    void bind() const { glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, object_ssbo); glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, material_ssbo); glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, light_ssbo); bound_version = version; }
+    void release() { glDeleteBuffers(1, &object_ssbo); glDeleteBuffers(1, &material_ssbo); glDeleteBuffers(1, &light_ssbo); object_ssbo = material_ssbo = light_ssbo = 0; }
+};
+
+// Float render target that sums samples: rgb holds radiance, alpha the sample count.
+// Normally it is the whole image; for tiled rendering it is the window starting at
+// (region_x, region_y) of an image_width x image_height image. With layers > 0 it is a
+// texture array holding one image per view of a batch.
+struct AccumulationTarget {
+    GLuint fbo = 0, texture = 0; int width = 0, height = 0, layers = 0;
+    int region_x = 0, region_y = 0, image_width = 0, image_height = 0;
+    void setRegion(int x, int y, int image_w, int image_h) { region_x = x; region_y = y; image_width = image_w; image_height = image_h; }
+    // internal_format GL_RGBA8 makes a plain display-encoded frame instead of an accumulator.
+    void create(int w, int h, int layer_count = 0, GLenum internal_format = GL_RGBA32F) {
+        width = w; height = h; layers = layer_count; setRegion(0, 0, w, h);
+        GLenum tex_target = layers ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D;
+        glGenTextures(1, &texture);
+        glBindTexture(tex_target, texture);
+        if (layers) glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, internal_format, w, h, layers, 0, GL_RGBA, GL_FLOAT, NULL);
+        else glTexImage2D(GL_TEXTURE_2D, 0, internal_format, w, h, 0, GL_RGBA, GL_FLOAT, NULL);
+        glTexParameteri(tex_target, GL_TEXTURE_MIN_FILTER, GL_NEAREST); glTexParameteri(tex_target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glGenFramebuffers(1, &fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, texture, 0); // all layers when layered
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) throw std::runtime_error("Accumulation framebuffer incomplete");
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        clear();
+    }
+    void clear() { glBindFramebuffer(GL_FRAMEBUFFER, fbo); glClearColor(0.0f, 0.0f, 0.0f, 0.0f); glClear(GL_COLOR_BUFFER_BIT); glBindFramebuffer(GL_FRAMEBUFFER, 0); }
+    std::vector<float> readback(int layer = 0) const { std::vector<float> rgba; readback(rgba, layer); return rgba; }
+    // Into a buffer the caller keeps, which then only grows with the target.
+    void readback(std::vector<float>& rgba, int layer = 0) const {
+        rgba.resize((size_t)width * height * 4);
+        GLuint read_fbo = fbo;
+        if (layers) { glGenFramebuffers(1, &read_fbo); glBindFramebuffer(GL_READ_FRAMEBUFFER, read_fbo); glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, texture, 0, layer); }
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, read_fbo);
+        glReadPixels(0, 0, width, height, GL_RGBA, GL_FLOAT, rgba.data());
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+        if (layers) glDeleteFramebuffers(1, &read_fbo);
+    }
+    void upload(const std::vector<float>& rgba) { glBindTexture(GL_TEXTURE_2D, texture); glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_FLOAT, rgba.data()); }
+    void release() { glDeleteFramebuffers(1, &fbo); glDeleteTextures(1, &texture); fbo = texture = 0; }
+};
+
+// Reads a target back through a pixel buffer object so the transfer overlaps further
+// rendering; poll() (or map()/unmap() to use the pixels in place) hands them over once the
+// fence behind the copy has passed. type is GL_FLOAT for accumulation sums or
+// GL_UNSIGNED_BYTE for display-encoded frames.
+struct AsyncReadback {
+    GLuint pbo = 0; GLsync fence = 0; size_t bytes = 0, capacity = 0;
+    bool pending() const { return fence != 0; }
+    void start(const AccumulationTarget& target, GLenum type = GL_FLOAT) {
+        bytes = (size_t)target.width * target.height * 4 * (type == GL_FLOAT ? sizeof(float) : 1);
+        if (!pbo) glGenBuffers(1, &pbo);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+        if (bytes != capacity) { glBufferData(GL_PIXEL_PACK_BUFFER, bytes, NULL, GL_STREAM_READ); capacity = bytes; }
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, target.fbo);
+        glReadPixels(0, 0, target.width, target.height, GL_RGBA, type, (void*)0);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glFlush();
+    }
+    const void* map(bool wait = false) {
+        if (!fence) return nullptr;
+        GLenum status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? GL_TIMEOUT_IGNORED : 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) return nullptr;
+        glDeleteSync(fence); fence = 0;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+        return glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT);
+    }
+    void unmap() { glUnmapBuffer(GL_PIXEL_PACK_BUFFER); glBindBuffer(GL_PIXEL_PACK_BUFFER, 0); }
+    bool poll(std::vector<float>& rgba, bool wait = false) {
+        const float* data = (const float*)map(wait);
+        if (!data) return false;
+        rgba.assign(data, data + bytes / sizeof(float));
+        unmap();
+        return true;
+    }
+    void release() { if (fence) glDeleteSync(fence); glDeleteBuffers(1, &pbo); fence = 0; pbo = 0; capacity = 0; }
+};
+
+// --- CPU Thread Pool ---
+// Phone SoCs pair fast and slow cores (big.LITTLE), and an even split of the work leaves the
+// fast cores waiting for the slow ones. The pool pins one worker to each CPU the process
+// may run on and gives each a capacity relative to the fastest. Capacities come from
+// cpu_capacity in sysfs where the kernel exports it, otherwise from a short calibration
+// loop; nearly equal ones are merged into core classes. A loop's index range is split in
+// proportion to capacity. A worker takes chunks of grain * capacity from the front of its
+// share, and once that runs dry it steals the back half of the largest share left. Little
+// cores thus take small chunks, and the tail of a loop never waits on one of them.
+struct CpuCore { int cpu; float capacity; }; // cpu -1: not pinned
+
+// Capacity measured as iterations of a dependent integer chain in a fixed time, all cores
+// at once, so shared caches and SMT siblings count the way they will under load.
+void measureCoreCapacities(std::vector<CpuCore>& cores) {
+    std::vector<uint64_t> iterations(cores.size());
+    std::atomic<bool> go{false};
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < cores.size(); ++i) threads.emplace_back([&, i]() {
+        cpu_set_t set; CPU_ZERO(&set); CPU_SET(cores[i].cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        while (!go) std::this_thread::yield();
+        auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(20);
+        uint64_t x = i + 1, n = 0;
+        for (; std::chrono::steady_clock::now() < end; n += 4096) for (int k = 0; k < 4096; ++k) x = x * 6364136223846793005ull + (x >> 29);
+        iterations[i] = n + (x & 1); // keeps the chain alive
+    });
+    go = true;
+    for (auto& t : threads) t.join();
+    for (size_t i = 0; i < cores.size(); ++i) cores[i].capacity = (float)iterations[i];
+}
+
+std::vector<CpuCore> detectCpuCores() {
+    std::vector<CpuCore> cores;
+    cpu_set_t allowed; CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) if (CPU_ISSET(cpu, &allowed)) cores.push_back({cpu, 0.0f});
+    if (cores.empty()) { cores.assign(std::max(1u, std::thread::hardware_concurrency()), {-1, 1.0f}); return cores; }
+    bool from_sysfs = true;
+    for (CpuCore& core : cores) { std::ifstream in("/sys/devices/system/cpu/cpu" + std::to_string(core.cpu) + "/cpu_capacity"); if (!(in >> core.capacity) || core.capacity <= 0.0f) from_sysfs = false; }
+    if (!from_sysfs) measureCoreCapacities(cores);
+    // Classes: sorted by capacity, a core more than 20% slower than its class's fastest starts a new one.
+    std::vector<CpuCore*> order; for (CpuCore& core : cores) order.push_back(&core);
+    std::sort(order.begin(), order.end(), [](const CpuCore* a, const CpuCore* b) { return a->capacity > b->capacity; });
+    const float fastest = std::max(order.front()->capacity, 1e-6f);
+    for (size_t first = 0, last; first < order.size(); first = last) {
+        float sum = 0.0f;
+        for (last = first; last < order.size() && order[last]->capacity >= 0.8f * order[first]->capacity; ++last) sum += order[last]->capacity;
+        for (size_t i = first; i < last; ++i) order[i]->capacity = sum / (last - first) / fastest;
+    }
+    return cores;
+}
+
+class ThreadPool {
+public:
+    explicit ThreadPool(const std::vector<CpuCore>& cores) : workers(cores.size()) {
+        for (size_t i = 0; i < cores.size(); ++i) {
+            workers[i].core = cores[i];
+            workers[i].thread = std::thread(&ThreadPool::work, this, i);
+            if (cores[i].cpu >= 0) { cpu_set_t set; CPU_ZERO(&set); CPU_SET(cores[i].cpu, &set); pthread_setaffinity_np(workers[i].thread.native_handle(), sizeof(set), &set); }
+        }
+    }
+    ~ThreadPool() { { std::lock_guard<std::mutex> lock(mutex); stopping = true; } wake.notify_all(); for (Worker& w : workers) w.thread.join(); }
+    size_t size() const { return workers.size(); }
+    // "8 threads: 4 at 1.00, 4 at 0.45", core classes from fastest to slowest.
+    std::string describe() const {
+        std::map<float, int, std::greater<float>> classes;
+        for (const Worker& w : workers) ++classes[w.core.capacity];
+        std::ostringstream out; out << workers.size() << " threads:" << std::fixed << std::setprecision(2);
+        const char* separator = " ";
+        for (const auto& c : classes) { out << separator << c.second << " at " << c.first; separator = ", "; }
+        return out.str();
+    }
+    // Calls body(begin, end) on disjoint ranges covering [0, count) from the workers and
+    // returns once all have run; the first exception thrown is rethrown here. grain is the
+    // chunk a core of capacity 1 takes at a time. Calls are serialized; body must not call
+    // parallelFor itself. The body is called through a plain pointer, so a call does not
+    // allocate; workers reset their threadArena() after it.
+    template <typename Body> void parallelFor(size_t count, size_t grain, const Body& body) {
+        run(count, grain, &body, [](const void* b, size_t begin, size_t end) { (*static_cast<const Body*>(b))(begin, end); });
+    }
+private:
+    using Invoke = void (*)(const void*, size_t, size_t);
+    void run(size_t count, size_t grain, const void* body, Invoke invoke) {
+        if (count == 0) return;
+        if (count >= (1ull << 32)) throw std::runtime_error("parallelFor range too large");
+        std::lock_guard<std::mutex> call(call_mutex);
+        double total = 0.0; for (const Worker& w : workers) total += w.core.capacity;
+        double start = 0.0;
+        for (Worker& w : workers) {
+            uint64_t begin = (uint64_t)std::llround(start / total * count), end = (uint64_t)std::llround((start += w.core.capacity) / total * count);
+            w.range = begin << 32 | end;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = body; job_invoke = invoke; job_grain = std::max<size_t>(grain, 1); error = nullptr;
+            running = workers.size(); ++generation;
+        }
+        wake.notify_all();
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&] { return running == 0; });
+        job = nullptr;
+        if (error) std::rethrow_exception(error);
+    }
+    struct Worker { CpuCore core{-1, 1.0f}; std::thread thread; std::atomic<uint64_t> range{0}; }; // range: begin << 32 | end
+    std::vector<Worker> workers;
+    std::mutex call_mutex, mutex; std::condition_variable wake, done;
+    const void* job = nullptr; Invoke job_invoke = nullptr; size_t job_grain = 1;
+    uint64_t generation = 0; size_t running = 0; bool stopping = false;
+    std::exception_ptr error;
+
+    // Takes up to n indices from the front of a range; false once it is empty.
+    static bool take(std::atomic<uint64_t>& range, uint64_t n, uint64_t& begin, uint64_t& end) {
+        uint64_t r = range.load();
+        do {
+            begin = r >> 32; uint64_t last = r & 0xffffffffull;
+            if (begin >= last) return false;
+            end = std::min(last, begin + n);
+            if (range.compare_exchange_weak(r, end << 32 | last)) return true;
+        } while (true);
+    }
+    // Moves the back half of the largest range left into this worker's own.
+    bool steal(Worker& self) {
+        while (true) {
+            Worker* victim = nullptr; uint64_t most = 0, r = 0;
+            for (Worker& w : workers) { uint64_t v = w.range.load(), left = (v & 0xffffffffull) - std::min<uint64_t>(v >> 32, v & 0xffffffffull); if (left > most) { most = left; victim = &w; r = v; } }
+            if (!victim) return false;
+            uint64_t begin = r >> 32, end = r & 0xffffffffull, middle = begin + (end - begin) / 2;
+            if (victim->range.compare_exchange_strong(r, begin << 32 | middle)) { self.range = middle << 32 | end; return true; }
+        }
+    }
+    void work(size_t index) {
+        Worker& self = workers[index];
+        uint64_t seen = 0;
+        while (true) {
+            const void* body; Invoke invoke; size_t grain;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation; body = job; invoke = job_invoke; grain = job_grain;
+            }
+            const uint64_t chunk = std::max<uint64_t>(1, (uint64_t)std::llround(grain * self.core.capacity));
+            try {
+                uint64_t begin, end;
+                do { while (take(self.range, chunk, begin, end)) invoke(body, begin, end); } while (steal(self));
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!error) error = std::current_exception();
+                self.range = 0;
+            }
+            threadArena().reset(); // nothing the job allocated from it outlives the job
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--running == 0) done.notify_all();
+        }
+    }
+};
+
+// The process-wide pool for CPU-side loops, created on first use.
+ThreadPool& cpuPool() { static ThreadPool pool(detectCpuCores()); return pool; }
+
+
+// --- Path Guiding ---
+const GLuint GUIDE_LOG_CAPACITY = 1 << 16; // samples logged per pass
+struct GuideSample { glm::vec4 direction; glm::uvec4 cell; };
+
+// Trains the guiding distributions on cpuPool() while the GPU renders. A trainer thread takes
+// each batch of logged samples, sorts it once into buckets of whole cells and lets the pool
+// train the buckets; a cell belongs to one bucket, so the histograms need no locks. reset()
+// starts a new generation: batches logged before it are skipped, and a cell's histogram is
+// cleared when the new generation first trains it. Fresh cumulative distributions are
+// published for upload.
+class PathGuide {
+public:
+    PathGuide() : histograms(GUIDE_CELLS * GUIDE_BINS, 0.0f), totals(GUIDE_CELLS, 0.0f), counts(GUIDE_CELLS, 0), cell_generations(GUIDE_CELLS, 0), touched(GUIDE_CELLS, 0), published(GUIDE_CELLS * GUIDE_BINS, 0.0f) {
+        for (Batch& batch : batches) batch.samples.reserve(GUIDE_LOG_CAPACITY);
+        sorted.reserve(GUIDE_LOG_CAPACITY);
+        trainer = std::thread(&PathGuide::run, this);
+    }
+    ~PathGuide() { { std::lock_guard<std::mutex> lock(mutex); stopping = true; } ready.notify_all(); trainer.join(); }
+    // Forgets what was learned, for new scene data.
+    void reset() {
+        std::lock_guard<std::mutex> lock(publish_mutex);
+        ++generation;
+        std::fill(published.begin(), published.end(), 0.0f); fresh = false;
+    }
+    // Copies the batch into the next free slot of a ring whose buffers are kept between
+    // batches. Drops the batch when training has fallen behind; the GPU only ever waits on itself.
+    void add(const GuideSample* samples, size_t count) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (pending == MAX_PENDING_BATCHES) return;
+        Batch& batch = batches[(first_batch + pending) % MAX_PENDING_BATCHES];
+        batch.samples.assign(samples, samples + count); batch.generation = generation;
+        ++pending;
+        ready.notify_all();
+    }
+    bool takeDistributions(std::vector<float>& cdf) {
+        std::lock_guard<std::mutex> lock(publish_mutex);
+        if (!fresh) return false;
+        cdf = published; fresh = false;
+        return true;
+    }
+    static GLuint bin(const glm::vec4& d) {
+        float phi = std::atan2(d.z, d.x); if (phi < 0.0f) phi += 2.0f * 3.14159265f;
+        GLuint p = std::min((GLuint)(phi / (2.0f * 3.14159265f) * GUIDE_PHI_BINS), GUIDE_PHI_BINS - 1), c = std::min((GLuint)std::max((d.y * 0.5f + 0.5f) * GUIDE_COS_BINS, 0.0f), GUIDE_COS_BINS - 1);
+        return p * GUIDE_COS_BINS + c;
+    }
+private:
+    static constexpr size_t MAX_PENDING_BATCHES = 4;
+    static constexpr GLuint BUCKETS = 64;            // units of pool work, each GUIDE_CELLS / BUCKETS consecutive cells
+    static constexpr int MIN_SAMPLES = 64;          // a cell's distribution is published after this many
+    static constexpr float MAX_WEIGHT = 64.0f;      // clamp so a single firefly cannot own a cell
+    static constexpr float UNIFORM_SHARE = 0.1f;    // mixed into every distribution: no bin is ever impossible
+    static_assert(GUIDE_CELLS % BUCKETS == 0, "buckets must hold whole cells");
+    // The slot at first_batch stays pending until trained, so add() never refills it meanwhile.
+    struct Batch { std::vector<GuideSample> samples; uint64_t generation = 0; };
+    void run() {
+        while (true) {
+            const Batch* batch;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                ready.wait(lock, [&] { return stopping || pending > 0; });
+                if (stopping) return;
+                batch = &batches[first_batch % MAX_PENDING_BATCHES];
+            }
+            train(*batch);
+            std::lock_guard<std::mutex> lock(mutex);
+            --pending; ++first_batch;
+        }
+    }
+    void train(const Batch& batch) {
+        if (batch.generation != generation) return;
+        // Counting sort by bucket; bucket_starts[b] is where bucket b begins in sorted.
+        auto valid = [](const GuideSample& s) { return s.cell.x < GUIDE_CELLS && s.direction.w > 0.0f; };
+        std::fill(std::begin(bucket_starts), std::end(bucket_starts), 0);
+        for (const GuideSample& s : batch.samples) if (valid(s)) ++bucket_starts[s.cell.x / (GUIDE_CELLS / BUCKETS) + 1];
+        for (GLuint b = 0; b < BUCKETS; ++b) bucket_starts[b + 1] += bucket_starts[b];
+        size_t next[BUCKETS]; std::copy(bucket_starts, bucket_starts + BUCKETS, next);
+        sorted.resize(bucket_starts[BUCKETS]); // within the reserved capacity
+        for (const GuideSample& s : batch.samples) if (valid(s)) sorted[next[s.cell.x / (GUIDE_CELLS / BUCKETS)]++] = s;
+        cpuPool().parallelFor(BUCKETS, 1, [&](size_t begin, size_t end) {
+            for (size_t b = begin; b < end; ++b) trainBucket(sorted.data() + bucket_starts[b], sorted.data() + bucket_starts[b + 1], batch.generation);
+        });
+    }
+    void trainBucket(const GuideSample* first, const GuideSample* last, uint64_t batch_generation) {
+        FrameVector<GLuint> cells, updated; FrameVector<float> cdfs; // cdfs: GUIDE_BINS per updated cell
+        cells.reserve(last - first);
+        for (const GuideSample* s = first; s != last; ++s) {
+            GLuint cell = s->cell.x;
+            if (cell_generations[cell] != batch_generation) {
+                cell_generations[cell] = batch_generation;
+                std::fill(histograms.begin() + cell * GUIDE_BINS, histograms.begin() + (cell + 1) * GUIDE_BINS, 0.0f); totals[cell] = 0.0f; counts[cell] = 0;
+            }
+            float w = std::min(s->direction.w, MAX_WEIGHT);
+            histograms[cell * GUIDE_BINS + bin(s->direction)] += w; totals[cell] += w; ++counts[cell];
+            if (!touched[cell]) { touched[cell] = 1; cells.push_back(cell); }
+        }
+        updated.reserve(cells.size()); cdfs.reserve(cells.size() * GUIDE_BINS);
+        for (GLuint cell : cells) {
+            touched[cell] = 0;
+            if (counts[cell] < MIN_SAMPLES) continue;
+            float sum = 0.0f;
+            for (GLuint b = 0; b < GUIDE_BINS; ++b) { sum += (1.0f - UNIFORM_SHARE) * histograms[cell * GUIDE_BINS + b] / totals[cell] + UNIFORM_SHARE / GUIDE_BINS; cdfs.push_back(sum); }
+            cdfs.back() = 1.0f;
+            updated.push_back(cell);
+        }
+        if (updated.empty()) return;
+        std::lock_guard<std::mutex> lock(publish_mutex);
+        if (batch_generation != generation) return; // reset() meanwhile
+        for (size_t u = 0; u < updated.size(); ++u) std::copy(cdfs.begin() + u * GUIDE_BINS, cdfs.begin() + (u + 1) * GUIDE_BINS, published.begin() + updated[u] * GUIDE_BINS);
+        fresh = true;
+    }
+    // Per cell, written only while training the cell's bucket. cell_generations: the
+    // generation whose samples the histogram holds.
+    std::vector<float> histograms, totals; std::vector<int> counts; std::vector<uint64_t> cell_generations; std::vector<char> touched;
+    std::vector<GuideSample> sorted; size_t bucket_starts[BUCKETS + 1]; // trainer thread only
+    std::mutex mutex; std::condition_variable ready; bool stopping = false;
+    Batch batches[MAX_PENDING_BATCHES]; uint64_t first_batch = 0; size_t pending = 0; // batch n lives in slot n % MAX_PENDING_BATCHES
+    std::mutex publish_mutex; std::vector<float> published; bool fresh = false;
+    std::atomic<uint64_t> generation{1}; // changed under publish_mutex, so nothing stale is published after reset()
+    std::thread trainer;
+};
+
+struct PathTracer {
+    // The path tracing program and its uniform locations. single_view draws one view;
+    // multi_view adds the geometry shader that sends instance i to layer i, and is only
+    // linked for batches (enableMultiView()).
+    struct TraceProgram {
+        GLuint id = 0;
+        GLint sample_index = -1, seed = -1, image_region = -1, radiance_cache = -1, cache_cell_size = -1, direct = -1, restir_gi = -1, caustics = -1, photon_radius = -1;
+        GLint guiding = -1, guide_cell_size = -1, guide_log_rate = -1, max_depth = -1, jitter = -1;
+        void create(const char* geometry_source) {
+            id = createShaderProgram(fragmentShaderSource.c_str(), geometry_source);
+            sample_index = glGetUniformLocation(id, "u_sample_index");
+            seed = glGetUniformLocation(id, "u_seed");
+            image_region = glGetUniformLocation(id, "u_image_region");
+            radiance_cache = glGetUniformLocation(id, "u_radiance_cache");
+            cache_cell_size = glGetUniformLocation(id, "u_cache_cell_size");
+            direct = glGetUniformLocation(id, "u_direct");
+            restir_gi = glGetUniformLocation(id, "u_restir_gi");
+            caustics = glGetUniformLocation(id, "u_caustics");
+            photon_radius = glGetUniformLocation(id, "u_photon_radius");
+            guiding = glGetUniformLocation(id, "u_guiding");
+            guide_cell_size = glGetUniformLocation(id, "u_guide_cell_size");
+            guide_log_rate = glGetUniformLocation(id, "u_guide_log_rate");
+            max_depth = glGetUniformLocation(id, "u_max_depth");
+            jitter = glGetUniformLocation(id, "u_jitter");
+        }
+    };
+    TraceProgram single_view, multi_view;
+    GLuint display_program = 0, vao = 0, vbo = 0, camera_ssbo = 0;
+    // The preview program (renderPreview()) and its uniform locations.
+    struct PreviewProgram {
+        GLuint id = 0;
+        GLint sample_index = -1, seed = -1, image_region = -1, mode = -1;
+        void create() {
+            id = createShaderProgram(previewShaderSource.c_str());
+            sample_index = glGetUniformLocation(id, "u_sample_index");
+            seed = glGetUniformLocation(id, "u_seed");
+            image_region = glGetUniformLocation(id, "u_image_region");
+            mode = glGetUniformLocation(id, "u_preview");
+        }
+    };
+    PreviewProgram preview_program;
+    GLuint cache_resolve_program = 0, cache_data = 0, cache_dirty = 0;
+    bool radiance_cache = false; float cache_cell_pixels = 8.0f;
+    uint32_t cache_scene_version = 0;
+    uint32_t seed = 0; int max_depth = 0; // 0: the shader's MAX_DEPTH
+    glm::vec2 jitter{0.0f}; // offset of the camera rays from the pixel centres, in pixels
+    Projection projection = PROJ_PINHOLE; // PROJ_CUBE_FACE expands every camera into six views
+    DirectLighting direct = DIRECT_BSDF; bool restir_gi = false;
+    Traversal traversal = TRAVERSAL_SCANLINE; // pixel order of the per-pixel compute passes
+    // A ReSTIR compute pass and its uniform locations; a pass that does not use a uniform
+    // keeps -1 there, which glUniform ignores.
+    struct ReSTIRPass {
+        GLuint id = 0;
+        GLint sample_index = -1, seed = -1, image_region = -1, direct = -1, radiance_cache = -1, cache_cell_size = -1, caustics = -1, photon_radius = -1;
+        GLint guiding = -1, guide_cell_size = -1, max_depth = -1, jitter = -1, traversal = -1, temporal = -1, prev_view = -1;
+        void create(const char* source) {
+            id = createComputeProgram(source);
+            sample_index = glGetUniformLocation(id, "u_sample_index");
+            seed = glGetUniformLocation(id, "u_seed");
+            image_region = glGetUniformLocation(id, "u_image_region");
+            direct = glGetUniformLocation(id, "u_direct");
+            radiance_cache = glGetUniformLocation(id, "u_radiance_cache");
+            cache_cell_size = glGetUniformLocation(id, "u_cache_cell_size");
+            caustics = glGetUniformLocation(id, "u_caustics");
+            photon_radius = glGetUniformLocation(id, "u_photon_radius");
+            guiding = glGetUniformLocation(id, "u_guiding");
+            guide_cell_size = glGetUniformLocation(id, "u_guide_cell_size");
+            max_depth = glGetUniformLocation(id, "u_max_depth");
+            jitter = glGetUniformLocation(id, "u_jitter");
+            traversal = glGetUniformLocation(id, "u_traversal");
+            temporal = glGetUniformLocation(id, "u_restir_temporal");
+            prev_view = glGetUniformLocation(id, "u_prev_view");
+        }
+    };
+    // ReSTIR: G-buffers alternate between frames, [1] of the reservoirs holds the final ones.
+    ReSTIRPass restir_initial, restir_spatial, restir_gi_initial, restir_gi_spatial;
+    GLuint restir_gbuffers[2] = {}, restir_reservoirs[2] = {}, restir_gi_reservoirs[3] = {}; // GI: two temporal (alternating), final
+    int restir_width = 0, restir_height = 0; uint32_t restir_frame = 0, restir_scene_version = 0; bool restir_history = false;
+    glm::mat4 view{1.0f}, restir_prev_view{1.0f};
+    // Photon mapping: a fresh caustic photon map per sample index. Progressive passes shrink
+    // the radius, counting passes from photon_first_sample.
+    Caustics caustics = CAUSTICS_PATH;
+    struct PhotonProgram {
+        GLuint id = 0;
+        GLint sample_index = -1, seed = -1, photon_count = -1, photon_radius = -1;
+        void create() {
+            id = createComputeProgram(photonTraceShaderSource.c_str());
+            sample_index = glGetUniformLocation(id, "u_sample_index");
+            seed = glGetUniformLocation(id, "u_seed");
+            photon_count = glGetUniformLocation(id, "u_photon_count");
+            photon_radius = glGetUniformLocation(id, "u_photon_radius");
+        }
+    };
+    PhotonProgram photon_program; GLuint photon_buffer = 0;
+    int photon_count = 1 << 16; float photon_radius = 0.05f, photon_alpha = 0.7f; uint32_t photon_first_sample = 0;
+    // Path guiding: distributions trained by guide on CPU threads from samples the GPU logs;
+    // the log is copied to guide_staging and read back once guide_fence has passed.
+    std::shared_ptr<PathGuide> guide; float guide_cell_size = 0.25f;
+    GLuint guide_buffer = 0, guide_staging = 0; GLsync guide_fence = 0; uint32_t guide_scene_version = 0;
+    std::vector<float> guide_cdf;
+    void init() {
+        single_view.create(nullptr);
+        display_program = createShaderProgram(displayShaderSource);
+        float quadVertices[] = { 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f };
+        glGenVertexArrays(1, &vao); glGenBuffers(1, &vbo);
+        glBindVertexArray(vao); glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), &quadVertices, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
+        glBindVertexArray(0);
+
+        glGenBuffers(1, &camera_ssbo);
+        preview_program.create();
+        glUseProgram(display_program);
+        glUniform1i(glGetUniformLocation(display_program, "u_accum"), 0);
+    }
+    void enableMultiView() { multi_view.create(viewGeometryShaderSource); }
+    void drawQuad(int instances = 1) const { glBindVertexArray(vao); glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, instances); glBindVertexArray(0); }
+    // The cache lives as long as the scene data it was trained on: it starts empty whenever a
+    // different upload of scene data is bound.
+    void enableRadianceCache() {
+        cache_resolve_program = createComputeProgram(cacheResolveShaderSource.c_str());
+        // Keys, pass sums and resolved radiance share one buffer (binding 3), the dirty list has its own (6).
+        const GLsizeiptr sizes[2] = {RADIANCE_CACHE_ENTRIES * (1 + 4 + 4) * sizeof(GLuint), (4 + RADIANCE_CACHE_ENTRIES) * sizeof(GLuint)};
+        GLuint* buffers[2] = {&cache_data, &cache_dirty};
+        const GLuint bindings[2] = {3, 6};
+        for (int i = 0; i < 2; ++i) { glGenBuffers(1, buffers[i]); glBindBuffer(GL_SHADER_STORAGE_BUFFER, *buffers[i]); glBufferData(GL_SHADER_STORAGE_BUFFER, sizes[i], NULL, GL_DYNAMIC_COPY); glBindBufferBase(GL_SHADER_STORAGE_BUFFER, bindings[i], *buffers[i]); }
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        radiance_cache = true;
+        clearRadianceCache();
+    }
+    void clearRadianceCache() {
+        const GLuint zero = 0;
+        for (GLuint buffer : {cache_data, cache_dirty}) { glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer); glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero); }
+        resetCacheDirtyList();
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        cache_scene_version = SceneBuffers::bound_version;
+    }
+    void resetCacheDirtyList() const { const GLuint dispatch[4] = {0, 1, 1, 0}; glBindBuffer(GL_SHADER_STORAGE_BUFFER, cache_dirty); glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(dispatch), dispatch); glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0); }
+    // ReSTIR DI (direct light at the primary hit) and ReSTIR GI (indirect light at the primary
+    // hit) share the G-buffers. Reservoir and G-buffer storage is sized on the first render and
+    // whenever the target size changes.
+    void enableReSTIR() {
+        restir_initial.create(restirInitialShaderSource.c_str());
+        restir_spatial.create(restirSpatialShaderSource.c_str());
+        createReSTIRBuffers();
+        direct = DIRECT_RESTIR;
+    }
+    void enableReSTIRGI() {
+        restir_gi_initial.create(restirGIInitialShaderSource.c_str());
+        restir_gi_spatial.create(restirGISpatialShaderSource.c_str());
+        createReSTIRBuffers();
+        restir_gi = true;
+    }
+    void createReSTIRBuffers() { if (!restir_gbuffers[0]) { glGenBuffers(2, restir_gbuffers); glGenBuffers(2, restir_reservoirs); glGenBuffers(3, restir_gi_reservoirs); } }
+    // Chooses every pixel's light sample and indirect path for the primary hit; the history
+    // is last frame's reservoirs, valid while the target size and scene data stay the same.
+    void runReSTIR(const AccumulationTarget& target, int view_count, uint32_t sample_index) {
+        if (view_count != 1 || projection != PROJ_PINHOLE || target.width != target.image_width || target.height != target.image_height) throw std::runtime_error("ReSTIR renders single full-frame pinhole views");
+        if (restir_width != target.width || restir_height != target.height) {
+            const GLsizeiptr pixels = (GLsizeiptr)target.width * target.height;
+            for (GLuint buffer : {restir_gbuffers[0], restir_gbuffers[1], restir_reservoirs[0], restir_reservoirs[1]}) { glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer); glBufferData(GL_SHADER_STORAGE_BUFFER, pixels * 2 * sizeof(glm::vec4), NULL, GL_DYNAMIC_COPY); }
+            for (GLuint buffer : restir_gi_reservoirs) { glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer); glBufferData(GL_SHADER_STORAGE_BUFFER, pixels * 4 * sizeof(glm::vec4), NULL, GL_DYNAMIC_COPY); }
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+            restir_width = target.width; restir_height = target.height; restir_history = false;
+        }
+        if (restir_scene_version != SceneBuffers::bound_version) { restir_scene_version = SceneBuffers::bound_version; restir_history = false; }
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, restir_gbuffers[restir_frame & 1]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, restir_gbuffers[(restir_frame + 1) & 1]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, restir_reservoirs[0]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 11, restir_reservoirs[1]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 12, restir_gi_reservoirs[restir_frame & 1]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 13, restir_gi_reservoirs[2]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 14, restir_gi_reservoirs[(restir_frame + 1) & 1]);
+        const ReSTIRPass* passes[4]; int pass_count = 0;
+        if (direct == DIRECT_RESTIR) { passes[pass_count++] = &restir_initial; passes[pass_count++] = &restir_spatial; }
+        if (restir_gi) { passes[pass_count++] = &restir_gi_initial; passes[pass_count++] = &restir_gi_spatial; }
+        for (int p = 0; p < pass_count; ++p) {
+            const ReSTIRPass& pass = *passes[p];
+            glUseProgram(pass.id);
+            glUniform1ui(pass.sample_index, sample_index);
+            glUniform1ui(pass.seed, seed);
+            glUniform4f(pass.image_region, 0.0f, 0.0f, (float)target.width, (float)target.height);
+            glUniform1i(pass.direct, direct);
+            glUniform1i(pass.radiance_cache, radiance_cache ? 1 : 0);
+            glUniform1f(pass.cache_cell_size, cacheCellSize(target));
+            glUniform1i(pass.caustics, caustics != CAUSTICS_PATH ? 1 : 0);
+            glUniform1f(pass.photon_radius, photonRadius(sample_index));
+            glUniform1i(pass.guiding, guide ? 1 : 0);
+            glUniform1f(pass.guide_cell_size, guide_cell_size);
+            glUniform1i(pass.max_depth, max_depth);
+            glUniform2f(pass.jitter, jitter.x, jitter.y);
+            glUniform1i(pass.traversal, traversal);
+            glUniform1i(pass.temporal, restir_history ? 1 : 0);
+            glUniformMatrix4fv(pass.prev_view, 1, GL_FALSE, glm::value_ptr(restir_prev_view));
+            glDispatchCompute((target.width + 7) / 8, (target.height + 7) / 8, 1);
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        }
+        restir_prev_view = view; restir_history = true; ++restir_frame;
+    }
+    void enableCaustics(Caustics mode) {
+        photon_program.create();
+        // Header, grid, then two vec4s per photon.
+        glGenBuffers(1, &photon_buffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, photon_buffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(glm::vec4) + PHOTON_GRID_CELLS * sizeof(GLint) + (GLsizeiptr)photon_count * 2 * sizeof(glm::vec4), NULL, GL_DYNAMIC_COPY);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 15, photon_buffer);
+        caustics = mode;
+    }
+    // Probabilistic progressive photon mapping: pass k uses r_k^2 = r_1^2 * prod_{i<k} (i + alpha) / (i + 1),
+    // so the passes' average converges while each pass stays an independent estimate.
+    float photonRadius(uint32_t sample_index) const {
+        if (caustics != CAUSTICS_PROGRESSIVE) return photon_radius;
+        double k = sample_index >= photon_first_sample ? sample_index - photon_first_sample + 1.0 : 1.0;
+        return photon_radius * (float)std::exp(0.5 * (std::lgamma(k + photon_alpha) - std::lgamma(1.0 + photon_alpha) - std::lgamma(k + 1.0)));
+    }
+    void tracePhotons(uint32_t sample_index) const {
+        const GLint empty = -1; const GLuint zero = 0;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, photon_buffer);
+        glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, 0, sizeof(glm::vec4), GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+        glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32I, sizeof(glm::vec4), PHOTON_GRID_CELLS * sizeof(GLint), GL_RED_INTEGER, GL_INT, &empty);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        glUseProgram(photon_program.id);
+        glUniform1ui(photon_program.sample_index, sample_index);
+        glUniform1ui(photon_program.seed, seed);
+        glUniform1ui(photon_program.photon_count, (GLuint)photon_count);
+        glUniform1f(photon_program.photon_radius, photonRadius(sample_index));
+        glDispatchCompute((photon_count + 63) / 64, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+    static constexpr GLsizeiptr GUIDE_CDF_OFFSET = sizeof(glm::uvec4), GUIDE_LOG_OFFSET = GUIDE_CDF_OFFSET + GUIDE_CELLS * GUIDE_BINS * sizeof(float);
+    void enableGuiding() {
+        glGenBuffers(1, &guide_buffer); glGenBuffers(1, &guide_staging);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, guide_buffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, GUIDE_LOG_OFFSET + GUIDE_LOG_CAPACITY * sizeof(GuideSample), NULL, GL_DYNAMIC_COPY);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, guide_buffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, guide_staging);
+        glBufferData(GL_COPY_WRITE_BUFFER, sizeof(glm::uvec4) + GUIDE_LOG_CAPACITY * sizeof(GuideSample), NULL, GL_STREAM_READ);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        guide = std::make_shared<PathGuide>();
+        resetGuide();
+    }
+    // Untrained distributions for new scene data; the trainer stays.
+    void resetGuide() {
+        guide->reset();
+        const GLuint zero = 0;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, guide_buffer);
+        glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        if (guide_fence) { glDeleteSync(guide_fence); guide_fence = 0; }
+        guide_scene_version = SceneBuffers::bound_version;
+    }
+    // Before a pass: hands the last copied log to the trainers, uploads distributions they
+    // published since, and empties the log. Returns the fraction of pixels to log this pass:
+    // none while the previous log is still in flight.
+    float prepareGuiding(int pixels) {
+        if (guide_scene_version != SceneBuffers::bound_version) resetGuide();
+        if (guide_fence) {
+            GLenum status = glClientWaitSync(guide_fence, 0, 0);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) return 0.0f;
+            glDeleteSync(guide_fence); guide_fence = 0;
+            glBindBuffer(GL_COPY_READ_BUFFER, guide_staging);
+            const char* data = (const char*)glMapBufferRange(GL_COPY_READ_BUFFER, 0, sizeof(glm::uvec4) + GUIDE_LOG_CAPACITY * sizeof(GuideSample), GL_MAP_READ_BIT);
+            GLuint count = std::min(*(const GLuint*)data, GUIDE_LOG_CAPACITY);
+            guide->add((const GuideSample*)(data + sizeof(glm::uvec4)), count);
+            glUnmapBuffer(GL_COPY_READ_BUFFER);
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        }
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, guide_buffer);
+        if (guide->takeDistributions(guide_cdf)) glBufferSubData(GL_SHADER_STORAGE_BUFFER, GUIDE_CDF_OFFSET, guide_cdf.size() * sizeof(float), guide_cdf.data());
+        const GLuint zero = 0;
+        glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, 0, sizeof(glm::uvec4), GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        return std::min(1.0f, GUIDE_LOG_CAPACITY / (3.0f * pixels)); // about three diffuse vertices per path
+    }
+    // After a pass that logged: copies the log out of the way of the next pass.
+    void collectGuideSamples() {
+        glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+        glBindBuffer(GL_COPY_READ_BUFFER, guide_buffer); glBindBuffer(GL_COPY_WRITE_BUFFER, guide_staging);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, sizeof(glm::uvec4));
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, GUIDE_LOG_OFFSET, sizeof(glm::uvec4), GUIDE_LOG_CAPACITY * sizeof(GuideSample));
+        glBindBuffer(GL_COPY_READ_BUFFER, 0); glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        guide_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glFlush();
+    }
+    float cacheCellSize(const AccumulationTarget& target) const { return cache_cell_pixels * 2.0f * std::tan(glm::radians(30.0f)) / (float)target.image_height; }
+    int viewsPerCamera() const { return projection == PROJ_CUBE_FACE ? 6 : 1; }
+    // Uploads the cameras of the next renderViews(); view i renders into layer i. Panoramas
+    // keep the horizon level: cube faces are axis-aligned in world space and equirectangular
+    // images only take the camera's heading.
+    void setCameras(const std::vector<Camera>& cameras) { setCameras(cameras.data(), cameras.size()); }
+    void setCameras(const Camera* cameras, size_t count) {
+        ArenaScope scope;
+        FrameVector<CameraData> data; data.reserve(count * viewsPerCamera());
+        if (count) view = cameras[0].view();
+        for (size_t i = 0; i < count; ++i) {
+            const Camera& c = cameras[i];
+            if (projection == PROJ_CUBE_FACE) { for (int face = 0; face < 6; ++face) data.push_back({glm::mat4(1.0f), glm::vec4(c.position, 1.0f), PROJ_CUBE_FACE, face, {}}); continue; }
+            Camera oriented = c;
+            if (projection == PROJ_EQUIRECT) {
+                glm::vec3 forward = c.target - c.position; forward.y = 0.0f;
+                oriented.target = c.position + (glm::length(forward) > 1e-6f ? forward : glm::vec3(0, 0, -1));
+            }
+            data.push_back({glm::inverse(oriented.view()), glm::vec4(c.position, 1.0f), projection, 0, {}});
+        }
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, camera_ssbo);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, data.size() * sizeof(CameraData), data.data(), GL_DYNAMIC_DRAW);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, camera_ssbo);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+    // Adds sample number sample_index of every pixel of the first view_count cameras into
+    // the target, all views in one draw. Disjoint index ranges give independent samples
+    // that can be summed in any order, on any machine.
+    void renderViews(const AccumulationTarget& target, int view_count, uint32_t sample_index) {
+        if (view_count > 1 && !multi_view.id) throw std::runtime_error("Rendering several views at once needs enableMultiView()");
+        if (radiance_cache && cache_scene_version != SceneBuffers::bound_version) clearRadianceCache();
+        if (caustics != CAUSTICS_PATH) tracePhotons(sample_index);
+        float guide_log_rate = guide ? prepareGuiding(target.width * target.height * view_count) : 0.0f;
+        if (direct == DIRECT_RESTIR || restir_gi) runReSTIR(target, view_count, sample_index);
+        glBindFramebuffer(GL_FRAMEBUFFER, target.fbo);
+        glViewport(0, 0, target.width, target.height);
+        glEnable(GL_BLEND); glBlendFunc(GL_ONE, GL_ONE);
+        const TraceProgram& program = view_count > 1 ? multi_view : single_view;
+        glUseProgram(program.id);
+        glUniform1ui(program.sample_index, sample_index);
+        glUniform1ui(program.seed, seed);
+        glUniform4f(program.image_region, (float)target.region_x, (float)target.region_y, (float)target.image_width, (float)target.image_height);
+        glUniform1i(program.radiance_cache, radiance_cache ? 1 : 0);
+        glUniform1i(program.direct, direct);
+        glUniform1i(program.restir_gi, restir_gi ? 1 : 0);
+        glUniform1i(program.caustics, caustics != CAUSTICS_PATH ? 1 : 0);
+        glUniform1f(program.photon_radius, photonRadius(sample_index));
+        glUniform1i(program.guiding, guide ? 1 : 0);
+        glUniform1f(program.guide_cell_size, guide_cell_size);
+        glUniform1f(program.guide_log_rate, guide_log_rate);
+        glUniform1i(program.max_depth, max_depth);
+        glUniform2f(program.jitter, jitter.x, jitter.y);
+        if (radiance_cache) glUniform1f(program.cache_cell_size, cacheCellSize(target));
+        drawQuad(view_count);
+        glDisable(GL_BLEND);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        if (guide_log_rate > 0.0f) collectGuideSamples();
+        if (radiance_cache) {
+            // The next pass reads what this one trained.
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+            glUseProgram(cache_resolve_program);
+            glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, cache_dirty);
+            glDispatchComputeIndirect(0);
+            glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+            resetCacheDirtyList();
+        }
+    }
+    void renderSample(const AccumulationTarget& target, const Camera& camera, uint32_t sample_index) { setCameras(&camera, 1); renderViews(target, 1, sample_index); }
+    // Adds one sample of a preview mode instead of a path-traced one; none of the passes that
+    // feed trace() run.
+    void renderPreview(const AccumulationTarget& target, const Camera& camera, uint32_t sample_index, Preview mode) {
+        setCameras(&camera, 1);
+        glBindFramebuffer(GL_FRAMEBUFFER, target.fbo);
+        glViewport(0, 0, target.width, target.height);
+        glEnable(GL_BLEND); glBlendFunc(GL_ONE, GL_ONE);
+        glUseProgram(preview_program.id);
+        glUniform1ui(preview_program.sample_index, sample_index);
+        glUniform1ui(preview_program.seed, seed);
+        glUniform4f(preview_program.image_region, (float)target.region_x, (float)target.region_y, (float)target.image_width, (float)target.image_height);
+        glUniform1i(preview_program.mode, mode);
+        drawQuad();
+        glDisable(GL_BLEND);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+    // Tone-maps the target into the window, or into the framebuffer fbo.
+    void display(const AccumulationTarget& target, int width, int height, GLuint fbo = 0) const {
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glViewport(0, 0, width, height);
+        glUseProgram(display_program);
+        glActiveTexture(GL_TEXTURE0); glBindTexture(GL_TEXTURE_2D, target.texture);
+        drawQuad();
+    }
+    void release() {
+        glDeleteVertexArrays(1, &vao); glDeleteBuffers(1, &vbo); glDeleteBuffers(1, &camera_ssbo); glDeleteProgram(single_view.id); glDeleteProgram(display_program); glDeleteProgram(preview_program.id);
+        if (multi_view.id) glDeleteProgram(multi_view.id);
+        if (radiance_cache) { glDeleteBuffers(1, &cache_data); glDeleteBuffers(1, &cache_dirty); glDeleteProgram(cache_resolve_program); }
+        if (restir_gbuffers[0]) { glDeleteBuffers(2, restir_gbuffers); glDeleteBuffers(2, restir_reservoirs); glDeleteBuffers(3, restir_gi_reservoirs); }
+        for (const ReSTIRPass* pass : {&restir_initial, &restir_spatial, &restir_gi_initial, &restir_gi_spatial}) if (pass->id) glDeleteProgram(pass->id);
+        if (photon_program.id) { glDeleteProgram(photon_program.id); glDeleteBuffers(1, &photon_buffer); }
+        if (guide_buffer) { guide.reset(); if (guide_fence) glDeleteSync(guide_fence); glDeleteBuffers(1, &guide_buffer); glDeleteBuffers(1, &guide_staging); }
+    }
+};
+
+// --- Space-Filling Curves ---
+// Point d of a Morton (Z-order) or Hilbert curve through an n x n grid, n a power of two; the
+// same decoding as the compute passes' dispatch_pixel().
+glm::uvec2 mortonDecode(uint32_t d) {
+    auto compact = [](uint32_t v) {
+        v &= 0x55555555u;
+        v = (v | (v >> 1)) & 0x33333333u; v = (v | (v >> 2)) & 0x0F0F0F0Fu;
+        v = (v | (v >> 4)) & 0x00FF00FFu; v = (v | (v >> 8)) & 0x0000FFFFu;
+        return v;
+    };
+    return {compact(d), compact(d >> 1)};
+}
+glm::uvec2 hilbertDecode(uint32_t n, uint32_t d) {
+    glm::uvec2 p(0u);
+    for (uint32_t s = 1; s < n; s *= 2) {
+        uint32_t rx = 1u & (d / 2), ry = 1u & (d ^ rx);
+        if (ry == 0) { if (rx == 1) p = glm::uvec2(s - 1) - p; std::swap(p.x, p.y); }
+        p += s * glm::uvec2(rx, ry);
+        d /= 4;
+    }
+    return p;
+}
+
+
+// --- Image I/O ---
+// Accumulation readbacks are RGBA sums; images are RGB means, bottom row first (GL and PFM order).
+void resolveAccumulation(const std::vector<float>& rgba, std::vector<float>& rgb) {
+    rgb.resize(rgba.size() / 4 * 3);
+    for (size_t i = 0; i < rgba.size() / 4; ++i) {
+        float n = rgba[i * 4 + 3] > 0.0f ? rgba[i * 4 + 3] : 1.0f;
+        for (int c = 0; c < 3; ++c) rgb[i * 3 + c] = rgba[i * 4 + c] / n;
+    }
+}
+std::vector<float> resolveAccumulation(const std::vector<float>& rgba) { std::vector<float> rgb; resolveAccumulation(rgba, rgb); return rgb; }
+void writePFM(const std::string& path, int width, int height, const std::vector<float>& rgb) {
+    std::ofstream out(path, std::ios::binary);
+    if (!out) throw std::runtime_error("Cannot write " + path);
+    out << "PF\n" << width << " " << height << "\n-1.0\n";
+    out.write(reinterpret_cast<const char*>(rgb.data()), rgb.size() * sizeof(float));
+}
+bool readPFM(const std::string& path, int& width, int& height, std::vector<float>& rgb) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+    std::string magic; float scale;
+    in >> magic >> width >> height >> scale; in.get();
+    if (magic != "PF" || scale >= 0.0f) return false; // only little-endian colour PFMs
+    rgb.resize((size_t)width * height * 3);
+    return (bool)in.read(reinterpret_cast<char*>(rgb.data()), rgb.size() * sizeof(float));
+}
+
+// Accumulation files hold raw RGBA sums (alpha = samples per pixel) of one contiguous range
+// of sample indices, so files from disjoint ranges merge by plain addition. Writers go
+// through a temporary file and rename() so readers on a shared filesystem never see a
+// partial file. The data is synced before the rename and the directory after it, so after
+// a power loss the path holds either the old file or the complete new one.
+const char ACCUMULATION_MAGIC[4] = {'H', 'R', 'T', 'A'};
+const uint32_t ACCUMULATION_VERSION = 1;
+struct AccumulationHeader {
+    char magic[4]; uint32_t version; uint32_t width, height; uint32_t seed;
+    uint32_t sample_start, sample_count; uint32_t _padding; uint64_t scene_hash;
+};
+struct AccumulationFile { AccumulationHeader header; std::vector<float> rgba; };
+
+void syncPath(const std::string& path, int flags) {
+    int fd = ::open(path.c_str(), flags | O_CLOEXEC);
+    if (fd < 0) throw std::runtime_error("Cannot open " + path + " to sync it");
+    int result = fsync(fd);
+    ::close(fd);
+    if (result != 0) throw std::runtime_error("Failed syncing " + path);
+}
+void writeAccumulationFile(const std::string& path, const AccumulationFile& file) {
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary);
+        if (!out) throw std::runtime_error("Cannot write " + tmp);
+        out.write(reinterpret_cast<const char*>(&file.header), sizeof(AccumulationHeader));
+        out.write(reinterpret_cast<const char*>(file.rgba.data()), file.rgba.size() * sizeof(float));
+        if (!out.flush()) throw std::runtime_error("Failed writing " + tmp);
+    }
+    syncPath(tmp, O_RDONLY);
+    std::filesystem::rename(tmp, path);
+    std::filesystem::path directory = std::filesystem::path(path).parent_path();
+    syncPath(directory.empty() ? "." : directory.string(), O_RDONLY | O_DIRECTORY);
+}
+AccumulationFile readAccumulationFile(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    AccumulationFile file;
+    if (!in.read(reinterpret_cast<char*>(&file.header), sizeof(AccumulationHeader)) || memcmp(file.header.magic, ACCUMULATION_MAGIC, 4) != 0) throw std::runtime_error("Not an accumulation file: " + path);
+    if (file.header.version != ACCUMULATION_VERSION) throw std::runtime_error("Unsupported accumulation file version: " + path);
+    file.rgba.resize((size_t)file.header.width * file.header.height * 4);
+    if (!in.read(reinterpret_cast<char*>(file.rgba.data()), file.rgba.size() * sizeof(float))) throw std::runtime_error("Truncated accumulation file: " + path);
+    return file;
+}
+AccumulationHeader makeAccumulationHeader(int width, int height, uint32_t seed, uint32_t sample_start, uint32_t sample_count, uint64_t scene_hash) {
+    AccumulationHeader h{};
+    memcpy(h.magic, ACCUMULATION_MAGIC, 4); h.version = ACCUMULATION_VERSION;
+    h.width = width; h.height = height; h.seed = seed; h.sample_start = sample_start; h.sample_count = sample_count; h.scene_hash = scene_hash;
+    return h;
+}
+
+// Streams a tiled BigTIFF (classic TIFF offsets stop at 4 GB) tile by tile: pixel data is
+// appended as tiles arrive, and the directory with the tile offset table is written last.
+// Memory use is one tile, independent of the image size.
+class TiledTiffWriter {
+public:
+    enum Format { U8, F32 };
+    TiledTiffWriter(const std::string& path, int width, int height, int tile, Format format) : out(path, std::ios::binary), width(width), height(height), tile(tile), format(format) {
+        if (!out) throw std::runtime_error("Cannot write " + path);
+        if (tile % 16) throw std::runtime_error("TIFF tile size must be a multiple of 16");
+        tiles_x = (width + tile - 1) / tile; tiles_y = (height + tile - 1) / tile;
+        offsets.assign((size_t)tiles_x * tiles_y, 0); byte_counts.assign(offsets.size(), 0);
+        out.write("II", 2); put<uint16_t>(43); put<uint16_t>(8); put<uint16_t>(0); put<uint64_t>(0); // first IFD offset, patched in finish()
+    }
+    int tilesX() const { return tiles_x; }
+    int tilesY() const { return tiles_y; }
+    // rgb: tile x tile linear RGB means, top row first. Tiles may arrive in any order.
+    void writeTile(int tx, int ty, const std::vector<float>& rgb) {
+        size_t index = (size_t)ty * tiles_x + tx;
+        offsets[index] = (uint64_t)out.tellp();
+        if (format == F32) out.write(reinterpret_cast<const char*>(rgb.data()), rgb.size() * sizeof(float));
+        else {
+            std::vector<uint8_t> bytes(rgb.size());
+            cpuPool().parallelFor(rgb.size(), 4096, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i) bytes[i] = (uint8_t)std::lround(std::clamp(std::pow(std::max(rgb[i], 0.0f), 1.0f / 2.2f), 0.0f, 1.0f) * 255.0f);
+            });
+            out.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+        }
+        byte_counts[index] = (uint64_t)out.tellp() - offsets[index];
+    }
+    void finish() {
+        const uint16_t SHORT = 3, LONG = 4, LONG8 = 16;
+        const uint16_t bits = format == F32 ? 32 : 8;
+        uint64_t offsets_pos = (uint64_t)out.tellp();
+        for (uint64_t o : offsets) put(o);
+        uint64_t counts_pos = (uint64_t)out.tellp();
+        for (uint64_t c : byte_counts) put(c);
+        // Three SHORTs fit in the 8-byte value field, where BigTIFF requires them to be stored inline.
+        auto threeShorts = [](uint64_t v) { return v | v << 16 | v << 32; };
+
+        uint64_t ifd_pos = (uint64_t)out.tellp();
+        struct Entry { uint16_t tag, type; uint64_t count, value; };
+        std::vector<Entry> entries = {
+            {256, LONG, 1, (uint64_t)width}, {257, LONG, 1, (uint64_t)height}, {258, SHORT, 3, threeShorts(bits)},
+            {259, SHORT, 1, 1}, {262, SHORT, 1, 2}, {277, SHORT, 1, 3}, {284, SHORT, 1, 1},
+            {322, LONG, 1, (uint64_t)tile}, {323, LONG, 1, (uint64_t)tile},
+            {324, LONG8, offsets.size(), offsets.size() == 1 ? offsets[0] : offsets_pos},
+            {325, LONG8, byte_counts.size(), byte_counts.size() == 1 ? byte_counts[0] : counts_pos},
+            {339, SHORT, 3, threeShorts(format == F32 ? 3 : 1)},
+        };
+        put<uint64_t>(entries.size());
+        for (const Entry& e : entries) { put(e.tag); put(e.type); put(e.count); put(e.value); }
+        put<uint64_t>(0);
+        out.seekp(8); put(ifd_pos);
+        if (!out.flush()) throw std::runtime_error("Failed writing TIFF");
+    }
+private:
+    std::ofstream out;
+    int width, height, tile, tiles_x, tiles_y; Format format;
+    std::vector<uint64_t> offsets, byte_counts;
+    template <typename T> void put(T v) { out.write(reinterpret_cast<const char*>(&v), sizeof(T)); }
+};
+
+
+// --- Image Error Metrics ---
+struct ImageError { double rmse; double relmse; double flip; };
+
+double computeRMSE(const std::vector<float>& ref, const std::vector<float>& test) {
+    double sum = 0.0;
+    for (size_t i = 0; i < ref.size(); ++i) { double d = test[i] - ref[i]; sum += d * d; }
+    return std::sqrt(sum / ref.size());
+}
+// Relative MSE with the usual epsilon so black reference pixels do not dominate.
+double computeRelMSE(const std::vector<float>& ref, const std::vector<float>& test) {
+    double sum = 0.0;
+    for (size_t i = 0; i < ref.size(); ++i) { double d = test[i] - ref[i]; sum += d * d / (ref[i] * ref[i] + 0.01); }
+    return sum / ref.size();
+}
+
+// LDR-FLIP (Andersson et al. 2020) evaluated on the images as the display shader shows them.
+namespace flip {
+const glm::vec3 WHITE(0.950428545f, 1.0f, 1.088900371f);
+
+inline float srgbToLinear(float c) { return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f); }
+inline glm::vec3 linearToXYZ(glm::vec3 c) { return glm::vec3(0.4124564f * c.x + 0.3575761f * c.y + 0.1804375f * c.z, 0.2126729f * c.x + 0.7151522f * c.y + 0.0721750f * c.z, 0.0193339f * c.x + 0.1191920f * c.y + 0.9503041f * c.z); }
+inline glm::vec3 xyzToLinear(glm::vec3 c) { return glm::vec3(3.2404542f * c.x - 1.5371385f * c.y - 0.4985314f * c.z, -0.9692660f * c.x + 1.8760108f * c.y + 0.0415560f * c.z, 0.0556434f * c.x - 0.2040259f * c.y + 1.0572252f * c.z); }
+inline glm::vec3 xyzToYCxCz(glm::vec3 c) { c = c / WHITE; return glm::vec3(116.0f * c.y - 16.0f, 500.0f * (c.x - c.y), 200.0f * (c.y - c.z)); }
+inline glm::vec3 yCxCzToXYZ(glm::vec3 c) { float y = (c.x + 16.0f) / 116.0f; return glm::vec3(c.y / 500.0f + y, y, y - c.z / 200.0f) * WHITE; }
+inline float labF(float t) { const float d = 6.0f / 29.0f; return t > d * d * d ? std::cbrt(t) : t / (3.0f * d * d) + 4.0f / 29.0f; }
+inline glm::vec3 xyzToHuntLab(glm::vec3 c) {
+    c = c / WHITE;
+    float L = 116.0f * labF(c.y) - 16.0f, a = 500.0f * (labF(c.x) - labF(c.y)), b = 200.0f * (labF(c.y) - labF(c.z));
+    return glm::vec3(L, 0.01f * L * a, 0.01f * L * b);
+}
+inline float hyab(glm::vec3 a, glm::vec3 b) { glm::vec3 d = a - b; return std::abs(d.x) + std::sqrt(d.y * d.y + d.z * d.z); }
+
+std::vector<float> kernel(int radius, float (*f)(float, float), float param) { std::vector<float> k(2 * radius + 1); for (int i = -radius; i <= radius; ++i) k[i + radius] = f((float)i, param); return k; }
+// Scales positive and negative weights to sum to +1 and -1 respectively (plain weights to 1).
+void normalizeKernel(std::vector<float>& k) {
+    float pos = 0.0f, neg = 0.0f;
+    for (float w : k) (w > 0.0f ? pos : neg) += w;
+    for (float& w : k) w = w > 0.0f ? w / pos : (neg < 0.0f ? -w / neg : 0.0f);
+}
+// Separable convolution with clamped borders; kx runs along rows, ky along columns. Rows
+// are spread over the CPU pool, one pass at a time.
+std::vector<float> convolve(const std::vector<float>& img, int w, int h, const std::vector<float>& kx, const std::vector<float>& ky) {
+    std::vector<float> tmp(img.size()), out(img.size());
+    int rx = (int)kx.size() / 2, ry = (int)ky.size() / 2;
+    cpuPool().parallelFor(h, 8, [&](size_t first, size_t last) {
+        for (int y = (int)first; y < (int)last; ++y) for (int x = 0; x < w; ++x) { float s = 0.0f; for (int i = -rx; i <= rx; ++i) s += kx[i + rx] * img[(size_t)y * w + std::clamp(x + i, 0, w - 1)]; tmp[(size_t)y * w + x] = s; }
+    });
+    cpuPool().parallelFor(h, 8, [&](size_t first, size_t last) {
+        for (int y = (int)first; y < (int)last; ++y) for (int x = 0; x < w; ++x) { float s = 0.0f; for (int i = -ry; i <= ry; ++i) s += ky[i + ry] * tmp[(size_t)std::clamp(y + i, 0, h - 1) * w + x]; out[(size_t)y * w + x] = s; }
+    });
+    return out;
+}
+
+// Contrast sensitivity filter of one YCxCz channel: a weighted sum of two Gaussians in visual degrees.
+std::vector<float> csfFilter(const std::vector<float>& channel, int w, int h, float ppd, float a1, float b1, float a2, float b2) {
+    const float PI = 3.14159265358979f;
+    int radius = (int)std::ceil(3.0f * std::sqrt(0.04f / (2.0f * PI * PI)) * ppd);
+    auto gauss = [&](float b) { std::vector<float> k(2 * radius + 1); for (int i = -radius; i <= radius; ++i) { float x = i / ppd; k[i + radius] = std::exp(-PI * PI * x * x / b); } return k; };
+    auto sum = [](const std::vector<float>& k) { float s = 0.0f; for (float v : k) s += v; return s; };
+    std::vector<float> g1 = gauss(b1); float m1 = a1 * (PI / b1) * sum(g1) * sum(g1);
+    normalizeKernel(g1);
+    std::vector<float> out = convolve(channel, w, h, g1, g1);
+    if (a2 <= 0.0f) return out;
+    std::vector<float> g2 = gauss(b2); float m2 = a2 * (PI / b2) * sum(g2) * sum(g2);
+    normalizeKernel(g2);
+    std::vector<float> second = convolve(channel, w, h, g2, g2);
+    for (size_t i = 0; i < out.size(); ++i) out[i] = (m1 * out[i] + m2 * second[i]) / (m1 + m2);
+    return out;
+}
+
+// Both inputs are linear RGB means; they are tone-mapped like the display shader first.
+double computeMeanFLIP(const std::vector<float>& ref, const std::vector<float>& test, int w, int h, float ppd = 67.0f) {
+    const size_t n = (size_t)w * h;
+    auto toYCxCz = [&](const std::vector<float>& rgb, std::vector<float> (&ch)[3], std::vector<float>& luminance) {
+        for (auto& c : ch) c.resize(n);
+        luminance.resize(n);
+        for (size_t i = 0; i < n; ++i) {
+            glm::vec3 c;
+            for (int k = 0; k < 3; ++k) c[k] = srgbToLinear(std::clamp(std::pow(std::max(rgb[i * 3 + k], 0.0f), 1.0f / 2.2f), 0.0f, 1.0f));
+            glm::vec3 xyz = linearToXYZ(c), ycc = xyzToYCxCz(xyz);
+            for (int k = 0; k < 3; ++k) ch[k][i] = ycc[k];
+            luminance[i] = xyz.y;
+        }
+    };
+    std::vector<float> ref_ch[3], test_ch[3], ref_y, test_y;
+    toYCxCz(ref, ref_ch, ref_y); toYCxCz(test, test_ch, test_y);
+
+    // Colour pipeline.
+    const float CSF[3][4] = {{1.0f, 0.0047f, 0.0f, 1e-5f}, {1.0f, 0.0053f, 0.0f, 1e-5f}, {34.1f, 0.04f, 13.5f, 0.025f}};
+    for (int k = 0; k < 3; ++k) {
+        ref_ch[k] = csfFilter(ref_ch[k], w, h, ppd, CSF[k][0], CSF[k][1], CSF[k][2], CSF[k][3]);
+        test_ch[k] = csfFilter(test_ch[k], w, h, ppd, CSF[k][0], CSF[k][1], CSF[k][2], CSF[k][3]);
+    }
+    auto huntAt = [&](std::vector<float> (&ch)[3], size_t i) {
+        glm::vec3 lin = glm::clamp(xyzToLinear(yCxCzToXYZ(glm::vec3(ch[0][i], ch[1][i], ch[2][i]))), 0.0f, 1.0f);
+        return xyzToHuntLab(linearToXYZ(lin));
+    };
+    const float qc = 0.7f, pc = 0.4f, pt = 0.95f;
+    const float cmax = std::pow(hyab(xyzToHuntLab(linearToXYZ(glm::vec3(0, 1, 0))), xyzToHuntLab(linearToXYZ(glm::vec3(0, 0, 1)))), qc);
+
+    // Feature pipeline: edges and points from Gaussian derivatives of luminance.
+    const float sigma = 0.5f * 0.082f * ppd;
+    const int radius = (int)std::ceil(3.0f * sigma);
+    std::vector<float> g = kernel(radius, [](float x, float s) { return std::exp(-x * x / (2.0f * s * s)); }, sigma);
+    std::vector<float> dg = kernel(radius, [](float x, float s) { return -x * std::exp(-x * x / (2.0f * s * s)); }, sigma);
+    std::vector<float> ddg = kernel(radius, [](float x, float s) { return (x * x / (s * s) - 1.0f) * std::exp(-x * x / (2.0f * s * s)); }, sigma);
+    normalizeKernel(g); normalizeKernel(dg); normalizeKernel(ddg);
+    auto features = [&](const std::vector<float>& y, std::vector<float>& edge, std::vector<float>& point) {
+        std::vector<float> ex = convolve(y, w, h, dg, g), ey = convolve(y, w, h, g, dg);
+        std::vector<float> px = convolve(y, w, h, ddg, g), py = convolve(y, w, h, g, ddg);
+        edge.resize(n); point.resize(n);
+        for (size_t i = 0; i < n; ++i) { edge[i] = std::sqrt(ex[i] * ex[i] + ey[i] * ey[i]); point[i] = std::sqrt(px[i] * px[i] + py[i] * py[i]); }
+    };
+    std::vector<float> ref_edge, ref_point, test_edge, test_point;
+    features(ref_y, ref_edge, ref_point); features(test_y, test_edge, test_point);
+
+    double total = 0.0;
+    for (size_t i = 0; i < n; ++i) {
+        float e = std::pow(hyab(huntAt(ref_ch, i), huntAt(test_ch, i)), qc);
+        float color = e < pc * cmax ? e * pt / (pc * cmax) : pt + (e - pc * cmax) / (cmax - pc * cmax) * (1.0f - pt);
+        float df = std::max(std::abs(ref_edge[i] - test_edge[i]), std::abs(ref_point[i] - test_point[i]));
+        float feature = std::pow(df / std::sqrt(2.0f), 0.5f);
+        total += std::pow(std::min(color, 1.0f), 1.0f - feature);
+    }
+    return total / n;
+}
+}
+
+ImageError computeImageError(const std::vector<float>& ref, const std::vector<float>& test, int width, int height) {
+    return { computeRMSE(ref, test), computeRelMSE(ref, test), flip::computeMeanFLIP(ref, test, width, height) };
+}
+
+
+// --- CPU Reference Tracer ---
+// A straight port of trace() from the fragment shader, run on all cores. It consumes the same
+// packed GPU data so both backends see an identical scene.
+class CpuTracer {
+public:
+    CpuTracer(const Scene& scene) : objects(scene.getObjectGPUData()), materials(scene.getMaterialGPUData()), sky(scene.sky) {}
+
+    // Returns the RGB mean of spp samples per pixel, bottom row first. Scanline traversal
+    // hands out runs of pixels; the curve orders hand out 8x8 tiles along the curve and walk
+    // each tile in Morton order. The result is the same either way.
+    std::vector<float> render(const Camera& camera, int width, int height, int spp, Traversal traversal = TRAVERSAL_SCANLINE) const {
+        std::vector<float> rgb((size_t)width * height * 3);
+        glm::mat4 inv_view = glm::inverse(camera.view());
+        const float tan_half_fov = std::tan(glm::radians(60.0f) / 2.0f), aspect = (float)width / (float)height;
+        auto shade = [&](int x, int y) {
+            glm::vec3 sum(0.0f);
+            for (int s = 0; s < spp; ++s) {
+                Rng rng(((uint64_t)y * width + x) * 0x9E3779B97F4A7C15ull + (uint64_t)s);
+                glm::vec2 uv(((float)x + 0.5f) / width, ((float)y + 0.5f) / height);
+                glm::vec3 dir = glm::normalize(glm::vec3((uv.x * 2.0f - 1.0f) * aspect * tan_half_fov, (uv.y * 2.0f - 1.0f) * tan_half_fov, -1.0f));
+                sum += trace({camera.position, glm::vec3(inv_view * glm::vec4(dir, 0.0f))}, rng);
+            }
+            for (int c = 0; c < 3; ++c) rgb[((size_t)y * width + x) * 3 + c] = sum[c] / (float)spp;
+        };
+        if (traversal == TRAVERSAL_SCANLINE) {
+            cpuPool().parallelFor((size_t)width * height, 64, [&](size_t begin, size_t end) { for (size_t i = begin; i < end; ++i) shade((int)(i % width), (int)(i / width)); });
+            return rgb;
+        }
+        uint32_t side = 1;
+        while (side * 8 < (uint32_t)std::max(width, height)) side *= 2;
+        cpuPool().parallelFor((size_t)side * side, 2, [&](size_t begin, size_t end) {
+            for (size_t t = begin; t < end; ++t) {
+                glm::uvec2 tile = traversal == TRAVERSAL_MORTON ? mortonDecode((uint32_t)t) : hilbertDecode(side, (uint32_t)t);
+                if (tile.x * 8 >= (uint32_t)width || tile.y * 8 >= (uint32_t)height) continue;
+                for (uint32_t p = 0; p < 64; ++p) { glm::uvec2 q = tile * 8u + mortonDecode(p); if (q.x < (uint32_t)width && q.y < (uint32_t)height) shade((int)q.x, (int)q.y); }
+            }
+        });
+        return rgb;
+    }
+
+private:
+    struct Ray { glm::vec3 origin, direction; };
+    struct Hit { bool is_hit = false; float t = 10000.0f; glm::vec3 point, normal; int material = 0; bool front_face = false; };
+    struct Rng {
+        uint64_t state;
+        Rng(uint64_t seed) : state(seed) { next(); }
+        uint64_t next() { uint64_t z = (state += 0x9E3779B97F4A7C15ull); z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull; z = (z ^ (z >> 27)) * 0x94D049BB133111EBull; return z ^ (z >> 31); }
+        float uniform() { return (float)(next() >> 40) / (float)(1u << 24); }
+    };
+    std::vector<ObjectData> objects;
+    std::vector<MaterialData> materials;
+    float sky;
+
+    static glm::vec3 randomInUnitSphere(Rng& rng) { while (true) { glm::vec3 p(rng.uniform() * 2.0f - 1.0f, rng.uniform() * 2.0f - 1.0f, rng.uniform() * 2.0f - 1.0f); if (glm::dot(p, p) < 1.0f) return p; } }
+    static glm::vec3 reflect(glm::vec3 v, glm::vec3 n) { return v - 2.0f * glm::dot(v, n) * n; }
+    static glm::vec3 refract(glm::vec3 uv, glm::vec3 n, float eta) { float cos_theta = std::min(glm::dot(-uv, n), 1.0f); glm::vec3 perp = eta * (uv + cos_theta * n); return perp - std::sqrt(std::abs(1.0f - glm::dot(perp, perp))) * n; }
+    static void setFaceNormal(Hit& h, const Ray& r, glm::vec3 n) { h.front_face = glm::dot(r.direction, n) < 0.0f; h.normal = h.front_face ? n : -n; }
+
+    void intersect(const Ray& r, Hit& hit) const {
+        for (const ObjectData& obj : objects) {
+            glm::vec3 center(obj.modelMatrix[3]);
+            if (obj.type == 0) {
+                glm::vec3 oc = r.origin - center;
+                float a = glm::dot(r.direction, r.direction), b = glm::dot(oc, r.direction), c = glm::dot(oc, oc) - obj.radius * obj.radius, disc = b * b - a * c;
+                if (disc < 0.0f) continue;
+                float t = (-b - std::sqrt(disc)) / a;
+                if (t < 0.001f) t = (-b + std::sqrt(disc)) / a;
+                if (t > 0.001f && t < hit.t) { hit.is_hit = true; hit.t = t; hit.point = r.origin + r.direction * t; setFaceNormal(hit, r, glm::normalize(hit.point - center)); hit.material = obj.materialIndex; }
+            } else if (obj.type == 2) {
+                glm::vec3 n = glm::normalize(glm::vec3(obj.modelMatrix * glm::vec4(0, 1, 0, 0)));
+                float denom = glm::dot(n, r.direction);
+                if (std::abs(denom) <= 0.001f) continue;
+                float t = glm::dot(center - r.origin, n) / denom;
+                if (t > 0.001f && t < hit.t) { hit.is_hit = true; hit.t = t; hit.point = r.origin + r.direction * t; setFaceNormal(hit, r, n); hit.material = obj.materialIndex; }
+            }
+        }
+    }
+
+    bool scatter(const Ray& in, const Hit& rec, glm::vec3& attenuation, Ray& scattered, Rng& rng) const {
+        const MaterialData& mat = materials[rec.material];
+        attenuation = glm::vec3(mat.baseColor);
+        if (mat.type == MAT_LAMBERTIAN) {
+            glm::vec3 dir = rec.normal + randomInUnitSphere(rng);
+            if (glm::length(dir) < 0.001f) dir = rec.normal;
+            scattered = {rec.point, glm::normalize(dir)};
+            return true;
+        }
+        if (mat.type == MAT_METAL) {
+            scattered = {rec.point, glm::normalize(reflect(in.direction, rec.normal) + mat.properties.y * randomInUnitSphere(rng))};
+            return glm::dot(scattered.direction, rec.normal) > 0.0f;
+        }
+        if (mat.type == MAT_GLASS) {
+            float ratio = rec.front_face ? (1.0f / mat.properties.z) : mat.properties.z;
+            float cos_theta = std::min(glm::dot(-in.direction, rec.normal), 1.0f), sin_theta = std::sqrt(1.0f - cos_theta * cos_theta);
+            float r0 = (1.0f - ratio) / (1.0f + ratio); r0 = r0 * r0;
+            float reflectance = r0 + (1.0f - r0) * std::pow(1.0f - cos_theta, 5.0f);
+            glm::vec3 dir = (ratio * sin_theta > 1.0f || reflectance > rng.uniform()) ? reflect(in.direction, rec.normal) : refract(in.direction, rec.normal, ratio);
+            scattered = {rec.point, glm::normalize(dir)};
+            return true;
+        }
+        return false;
+    }
+
+    glm::vec3 trace(Ray r, Rng& rng) const {
+        glm::vec3 color(0.0f), attenuation(1.0f);
+        for (int depth = 0; depth < MAX_DEPTH; ++depth) {
+            Hit hit;
+            intersect(r, hit);
+            if (!hit.is_hit) {
+                float t = 0.5f * (r.direction.y + 1.0f);
+                color += glm::mix(glm::vec3(1.0f), glm::vec3(0.5f, 0.7f, 1.0f), t) * sky * attenuation;
+                break;
+            }
+            glm::vec3 emitted(materials[hit.material].emission), current;
+            Ray scattered;
+            bool bounced = scatter(r, hit, current, scattered, rng);
+            if (bounced) attenuation *= current;
+            color += emitted * attenuation;
+            if (!bounced) break;
+            r = scattered;
+        }
+        return color;
+    }
+};
+
+
+// --- JSON ---
+// Just enough of a reader for the files this program writes itself.
+struct JsonValue {
+    enum Type { Null, Bool, Number, String, Array, Object } type = Null;
+    double number = 0.0; std::string string; std::vector<JsonValue> array; std::map<std::string, JsonValue> object;
+    const JsonValue& operator[](const std::string& key) const { auto it = object.find(key); if (it == object.end()) throw std::runtime_error("JSON key not found: " + key); return it->second; }
+    bool has(const std::string& key) const { return object.count(key) != 0; }
+};
+
+class JsonParser {
+public:
+    JsonParser(const std::string& text) : s(text) {}
+    JsonValue parse() { JsonValue v = value(); skip(); if (pos != s.size()) fail("trailing characters"); return v; }
+    static JsonValue parseFile(const std::string& path) { std::ifstream in(path); if (!in) throw std::runtime_error("Cannot read " + path); std::stringstream ss; ss << in.rdbuf(); return JsonParser(ss.str()).parse(); }
+
+private:
+    const std::string& s; size_t pos = 0;
+    void fail(const std::string& what) { throw std::runtime_error("JSON parse error at " + std::to_string(pos) + ": " + what); }
+    void skip() { while (pos < s.size() && isspace((unsigned char)s[pos])) ++pos; }
+    bool consume(char c) { skip(); if (pos < s.size() && s[pos] == c) { ++pos; return true; } return false; }
+    void expect(char c) { if (!consume(c)) fail(std::string("expected '") + c + "'"); }
+    std::string str() {
+        expect('"'); std::string out;
+        while (pos < s.size() && s[pos] != '"') { if (s[pos] == '\\' && pos + 1 < s.size()) ++pos; out += s[pos++]; }
+        expect('"'); return out;
+    }
+    JsonValue value() {
+        JsonValue v; skip();
+        if (pos >= s.size()) fail("unexpected end");
+        char c = s[pos];
+        if (c == '{') {
+            v.type = JsonValue::Object; ++pos;
+            if (consume('}')) return v;
+            do { std::string key = (skip(), str()); expect(':'); v.object[key] = value(); } while (consume(','));
+            expect('}');
+        } else if (c == '[') {
+            v.type = JsonValue::Array; ++pos;
+            if (consume(']')) return v;
+            do v.array.push_back(value()); while (consume(','));
+            expect(']');
+        } else if (c == '"') { v.type = JsonValue::String; v.string = str(); }
+        else if (s.compare(pos, 4, "true") == 0) { v.type = JsonValue::Bool; v.number = 1.0; pos += 4; }
+        else if (s.compare(pos, 5, "false") == 0) { v.type = JsonValue::Bool; pos += 5; }
+        else if (s.compare(pos, 4, "null") == 0) pos += 4;
+        else { size_t used = 0; v.type = JsonValue::Number; try { v.number = std::stod(s.substr(pos, 32), &used); } catch (...) { fail("bad value"); } pos += used; }
+        return v;
+    }
+};
+
+
+// --- Command Line ---
+struct Options {
+    bool convergence = false, benchmark = false, render = false;
+    std::vector<std::string> compare_files;
+    std::vector<std::string> scenes;
+    int width = SCREEN_WIDTH, height = SCREEN_HEIGHT;
+    int reference_spp = 4096; std::string reference_device = "gpu"; std::string reference_dir = "references";
+    int max_spp = 1024; double time_budget = 60.0;
+    int trials = 5, frames = 60, warmup_frames = 10; double cooldown = 0.0;
+    double alpha = 0.05, threshold = 0.02;
+    std::string out;
+    std::string record_file, replay_file;
+    uint32_t seed = 0;
+    int spp = 256; uint32_t sample_start = 0, sample_count = 0; int slice_index = 0, slice_count = 1; int spawn = 0;
+    std::string merge_output; std::vector<std::string> merge_inputs; int expect_parts = 0; double merge_timeout = 3600.0;
+    std::string checkpoint; double checkpoint_interval = 60.0; bool resume = false;
+    int tiled_width = 0, tiled_height = 0, tile_size = 512; std::string tile_format = "u8";
+    std::string views_file; int turntable = 0;
+    Projection projection = PROJ_PINHOLE;
+    std::string serve_socket, submit_socket; int priority = 0;
+    std::string publish_ring, consume_ring; int ring_slots = 3;
+    bool radiance_cache = false; float cache_cell_pixels = 8.0f;
+    DirectLighting direct = DIRECT_BSDF; bool restir_gi = false;
+    Caustics caustics = CAUSTICS_PATH; int photon_count = 1 << 16; float photon_radius = 0.05f, photon_alpha = 0.7f;
+    bool guiding = false; float guide_cell_size = 0.25f;
+    bool refine = false; Preview preview = PREVIEW_NONE;
+    uint32_t target_spp = 0; double target_noise = 0.0, max_fps = 0.0; int swap_interval = INT_MIN; // INT_MIN: the driver's default
+    Traversal traversal = TRAVERSAL_SCANLINE;
+    bool governor = false; std::string sysfs_root = "/sys"; double temp_target = 75.0, power_target = 0.0; int governor_spp = 4;
+    bool alloc_stats = false, self_test = false;
+    float render_scale = 1.0f, sharpness = 1.0f; Upscale upscale = UPSCALE_EASU; // sharpness: RCAS, in stops below the strongest
+    bool batch() const { return !views_file.empty() || turntable > 0 || projection == PROJ_CUBE_FACE; }
+};
+
+void printUsage() {
+    std::cout << "Usage: raytracer [options]\n"
+                 "  (no options)              interactive orbit viewer\n"
+                 "  --convergence             time-to-quality benchmark against reference images\n"
+                 "  --scene NAME              benchmark scene (repeatable; default: all)\n"
+                 "  --size WxH                benchmark resolution (default " << SCREEN_WIDTH << "x" << SCREEN_HEIGHT << ")\n"
+                 "  --reference-spp N         samples per pixel of reference images (default 4096)\n"
+                 "  --reference-device D      gpu or cpu (default gpu)\n"
+                 "  --reference-dir DIR       cache directory for reference PFMs (default references)\n"
+                 "  --max-spp N               stop a convergence run after N spp (default 1024)\n"
+                 "  --time-budget SECONDS     stop a convergence run after this much render time (default 60)\n"
+                 "  --out PREFIX              writes PREFIX.csv and PREFIX.json (default convergence)\n"
+                 "  --benchmark               frame-time benchmark over repeated trials, written to PREFIX.json (default benchmark)\n"
+                 "  --trials N --frames M     trials per scene and timed frames per trial (default 5 and 60)\n"
+                 "  --warmup N                untimed frames before each trial (default 10)\n"
+                 "  --cooldown SECONDS        idle time between trials to let the device cool (default 0)\n"
+                 "  --compare BASE NEW        compare two benchmark JSON files; exits 1 on a significant regression\n"
+                 "  --alpha P                 significance level of the comparison (default 0.05)\n"
+                 "  --threshold F             ignore changes smaller than this fraction of the median (default 0.02)\n"
+                 "  --record FILE             record camera, key input and scene edits of an interactive session\n"
+                 "  --replay FILE             replay a recording frame by frame, independent of wall-clock time\n"
+                 "  --refine                  interactive: after a camera move or edit, show 1/8, 1/4 and 1/2 resolution\n"
+                 "                            frames before accumulating at full resolution\n"
+                 "  --preview MODE            interactive: while the camera or scene changes, show a cheap preview instead of\n"
+                 "                            path tracing: shaded (primary hit, headlight), ao (short-range ambient occlusion)\n"
+                 "                            or direct (lights and one sky ray); path tracing resumes once it stops\n"
+                 "  --target-spp N            interactive: stop rendering a still image after N samples and wait for input\n"
+                 "  --target-noise X          interactive: stop once the estimated relative RMS noise falls below X\n"
+                 "  --max-fps F               interactive: cap the frame rate at F\n"
+                 "  --swap-interval N         interactive: 0 immediate, 1 vsync, -1 adaptive vsync (default: the driver's)\n"
+                 "  --governor                interactive: pace frames at --max-fps (default 30) and lower samples per frame,\n"
+                 "                            path depth and resolution to stay under the temperature and power targets\n"
+                 "  --temp-target C           governor: hottest thermal zone to stay under, in degrees C (default 75)\n"
+                 "  --power-target W          governor: battery discharge to stay under, in watts (default: none)\n"
+                 "  --governor-spp N          governor: samples per frame at the top level, a power of two (default 4)\n"
+                 "  --sysfs-root DIR          governor: where to read thermal zones, cpufreq, devfreq and batteries (default /sys)\n"
+                 "  --render-scale F          interactive: trace F of the width and height (0.25 to 1) and upscale to --size\n"
+                 "  --upscale MODE            how frames traced below --size are scaled up: easu (edge-adaptive, then RCAS\n"
+                 "                            sharpening; default), bilinear, or taau (jittered samples accumulated into a\n"
+                 "                            reprojected full-resolution history, then RCAS; also antialiases at scale 1)\n"
+                 "  --sharpness STOPS         easu, taau: RCAS sharpening, 0 strongest, each stop halves it (default 1)\n"
+                 "  --alloc-stats             interactive: count heap allocations per frame and report them at exit; with\n"
+                 "                            --replay, exits 1 if a steady-state frame allocated\n"
+                 "  --self-test               run the headless checks (governor, frame ring, thread pool, pixel orders); exits 1 on a failure\n"
+                 "  --seed N                  global RNG seed; samples depend only on pixel, sample index and seed (default 0)\n"
+                 "  --render                  headless render of one scene into an accumulation file (--out, default render.hrta)\n"
+                 "  --spp N                   total samples per pixel of the render (default 256)\n"
+                 "  --samples START:COUNT     render exactly this range of sample indices\n"
+                 "  --slice K/N               render the K-th of N equal slices of --spp (K from 0)\n"
+                 "  --spawn N                 split the render across N local processes and merge the result\n"
+                 "  --merge OUT IN...         sum accumulation files or directories of them into OUT (.hrta or .pfm)\n"
+                 "  --expect N                with --merge, wait until N parts exist (shared-filesystem rendering)\n"
+                 "  --merge-timeout SECONDS   give up waiting for parts after this long (default 3600)\n"
+                 "  --checkpoint FILE         checkpoint file of --render (default OUT.ckpt)\n"
+                 "  --checkpoint-interval S   seconds between checkpoints, 0 disables them (default 60)\n"
+                 "  --resume                  continue --render from its checkpoint if one exists\n"
+                 "  --tiled WxH               render a WxH image tile by tile into a tiled TIFF (--out, default poster.tif)\n"
+                 "  --tile N                  tile edge in pixels, a multiple of 16 (default 512)\n"
+                 "  --tile-format F           u8 (display-encoded) or f32 (linear) samples (default u8)\n"
+                 "  --views FILE              render every camera of a JSON list in one batch into an atlas PFM (--out, default views.pfm)\n"
+                 "  --turntable N             batch of N cameras circling the scene at the scene camera's distance and height\n"
+                 "  --projection P            pinhole, equirect (360x180 degrees; use a 2:1 --size) or cube (six 90-degree\n"
+                 "                            faces per camera, rendered as one batch) (default pinhole)\n"
+                 "  --serve SOCKET            render server: take jobs from a Unix socket until SIGTERM/SIGINT\n"
+                 "  --submit SOCKET           send one job per camera (scene camera, --views or --turntable) to a server\n"
+                 "                            and write the frames to --out (default frame.pfm)\n"
+                 "  --priority N              job priority for --submit; higher runs first (default 0)\n"
+                 "  --publish NAME            interactive: publish every displayed frame (RGBA8, --size) to shared memory /NAME\n"
+                 "  --ring-slots N            frames kept in the shared-memory ring (default 3)\n"
+                 "  --consume NAME            attach to a published ring, report frame rate and drops, save the last\n"
+                 "                            frame to --out (default latest.ppm)\n"
+                 "  --radiance-cache          end paths after their first diffuse bounce in a world-space radiance cache\n"
+                 "  --cache-cell PIXELS       cache cell edge in pixel footprints at the cell's distance (default 8)\n"
+                 "  --direct MODE             direct lighting from emissive spheres: bsdf (hit them by chance), nee (one shadow\n"
+                 "                            ray per diffuse vertex) or restir (NEE with spatiotemporal reservoir reuse at\n"
+                 "                            the primary hit; single full-frame pinhole views only) (default bsdf)\n"
+                 "  --restir-gi               indirect light at the primary hit from ReSTIR GI: one path per pixel and frame,\n"
+                 "                            resampled across neighbours and frames (single full-frame pinhole views only)\n"
+                 "  --caustics MODE           caustics from lights through glass and metal spheres: path (path tracing only),\n"
+                 "                            photons (a photon map per sample) or progressive (shrinking radius) (default path)\n"
+                 "  --photons N               caustic photons emitted per sample (default 65536)\n"
+                 "  --photon-radius R         density estimation radius in world units; the first radius when progressive (default 0.05)\n"
+                 "  --photon-alpha A          progressive radius reduction, in (0, 1); smaller shrinks faster (default 0.7)\n"
+                 "  --guiding                 path guiding: diffuse bounces also sample directions from distributions that CPU\n"
+                 "                            threads learn from logged GPU paths (unbiased, but not bit-reproducible)\n"
+                 "  --guide-cell SIZE         edge of a guiding cell in world units (default 0.25)\n"
+                 "  --traversal ORDER         pixel order of the CPU tracer and the ReSTIR compute passes: scanline, morton or\n"
+                 "                            hilbert (8x8 tiles along a space-filling curve) (default scanline)\n";
+}
+
+Options parseOptions(int argc, char* argv[]) {
+    Options opts;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto value = [&]() -> std::string { if (i + 1 >= argc) throw std::runtime_error("Missing value for " + arg); return argv[++i]; };
+        if (arg == "--convergence") opts.convergence = true;
+        else if (arg == "--scene") opts.scenes.push_back(value());
+        else if (arg == "--size") { std::string v = value(); if (sscanf(v.c_str(), "%dx%d", &opts.width, &opts.height) != 2 || opts.width <= 0 || opts.height <= 0) throw std::runtime_error("Bad size: " + v); }
+        else if (arg == "--reference-spp") opts.reference_spp = std::stoi(value());
+        else if (arg == "--reference-device") opts.reference_device = value();
+        else if (arg == "--reference-dir") opts.reference_dir = value();
+        else if (arg == "--max-spp") opts.max_spp = std::stoi(value());
+        else if (arg == "--time-budget") opts.time_budget = std::stod(value());
+        else if (arg == "--out") opts.out = value();
+        else if (arg == "--benchmark") opts.benchmark = true;
+        else if (arg == "--trials") opts.trials = std::stoi(value());
+        else if (arg == "--frames") opts.frames = std::stoi(value());
+        else if (arg == "--warmup") opts.warmup_frames = std::stoi(value());
+        else if (arg == "--cooldown") opts.cooldown = std::stod(value());
+        else if (arg == "--compare") { opts.compare_files.push_back(value()); opts.compare_files.push_back(value()); }
+        else if (arg == "--alpha") opts.alpha = std::stod(value());
+        else if (arg == "--threshold") opts.threshold = std::stod(value());
+        else if (arg == "--record") opts.record_file = value();
+        else if (arg == "--replay") opts.replay_file = value();
+        else if (arg == "--refine") opts.refine = true;
+        else if (arg == "--target-spp") opts.target_spp = (uint32_t)std::stoul(value());
+        else if (arg == "--target-noise") opts.target_noise = std::stod(value());
+        else if (arg == "--max-fps") opts.max_fps = std::stod(value());
+        else if (arg == "--swap-interval") opts.swap_interval = std::stoi(value());
+        else if (arg == "--governor") opts.governor = true;
+        else if (arg == "--temp-target") opts.temp_target = std::stod(value());
+        else if (arg == "--power-target") opts.power_target = std::stod(value());
+        else if (arg == "--governor-spp") opts.governor_spp = std::stoi(value());
+        else if (arg == "--sysfs-root") opts.sysfs_root = value();
+        else if (arg == "--alloc-stats") opts.alloc_stats = true;
+        else if (arg == "--self-test") opts.self_test = true;
+        else if (arg == "--render-scale") opts.render_scale = std::stof(value());
+        else if (arg == "--upscale") { std::string v = value(); opts.upscale = v == "easu" ? UPSCALE_EASU : v == "bilinear" ? UPSCALE_BILINEAR : v == "taau" ? UPSCALE_TAAU : throw std::runtime_error("--upscale must be easu, bilinear or taau"); }
+        else if (arg == "--sharpness") opts.sharpness = std::stof(value());
+        else if (arg == "--preview") { std::string v = value(); opts.preview = v == "shaded" ? PREVIEW_SHADED : v == "ao" ? PREVIEW_AO : v == "direct" ? PREVIEW_DIRECT : throw std::runtime_error("--preview must be shaded, ao or direct"); }
+        else if (arg == "--seed") opts.seed = (uint32_t)std::stoul(value());
+        else if (arg == "--render") opts.render = true;
+        else if (arg == "--spp") opts.spp = std::stoi(value());
+        else if (arg == "--samples") { std::string v = value(); if (sscanf(v.c_str(), "%u:%u", &opts.sample_start, &opts.sample_count) != 2 || !opts.sample_count) throw std::runtime_error("Bad sample range: " + v); }
+        else if (arg == "--slice") { std::string v = value(); if (sscanf(v.c_str(), "%d/%d", &opts.slice_index, &opts.slice_count) != 2 || opts.slice_count < 1 || opts.slice_index < 0 || opts.slice_index >= opts.slice_count) throw std::runtime_error("Bad slice: " + v); }
+        else if (arg == "--spawn") opts.spawn = std::stoi(value());
+        else if (arg == "--merge") { opts.merge_output = value(); while (i + 1 < argc && argv[i + 1][0] != '-') opts.merge_inputs.push_back(argv[++i]); }
+        else if (arg == "--expect") opts.expect_parts = std::stoi(value());
+        else if (arg == "--merge-timeout") opts.merge_timeout = std::stod(value());
+        else if (arg == "--checkpoint") opts.checkpoint = value();
+        else if (arg == "--checkpoint-interval") opts.checkpoint_interval = std::stod(value());
+        else if (arg == "--resume") opts.resume = true;
+        else if (arg == "--tiled") { std::string v = value(); if (sscanf(v.c_str(), "%dx%d", &opts.tiled_width, &opts.tiled_height) != 2 || opts.tiled_width <= 0 || opts.tiled_height <= 0) throw std::runtime_error("Bad size: " + v); }
+        else if (arg == "--tile") opts.tile_size = std::stoi(value());
+        else if (arg == "--tile-format") opts.tile_format = value();
+        else if (arg == "--views") opts.views_file = value();
+        else if (arg == "--turntable") opts.turntable = std::stoi(value());
+        else if (arg == "--serve") opts.serve_socket = value();
+        else if (arg == "--submit") opts.submit_socket = value();
+        else if (arg == "--priority") opts.priority = std::stoi(value());
+        else if (arg == "--publish") opts.publish_ring = value();
+        else if (arg == "--ring-slots") opts.ring_slots = std::stoi(value());
+        else if (arg == "--consume") opts.consume_ring = value();
+        else if (arg == "--radiance-cache") opts.radiance_cache = true;
+        else if (arg == "--cache-cell") opts.cache_cell_pixels = std::stof(value());
+        else if (arg == "--direct") { std::string v = value(); opts.direct = v == "bsdf" ? DIRECT_BSDF : v == "nee" ? DIRECT_NEE : v == "restir" ? DIRECT_RESTIR : throw std::runtime_error("--direct must be bsdf, nee or restir"); }
+        else if (arg == "--restir-gi") opts.restir_gi = true;
+        else if (arg == "--caustics") { std::string v = value(); opts.caustics = v == "path" ? CAUSTICS_PATH : v == "photons" ? CAUSTICS_PHOTONS : v == "progressive" ? CAUSTICS_PROGRESSIVE : throw std::runtime_error("--caustics must be path, photons or progressive"); }
+        else if (arg == "--photons") opts.photon_count = std::stoi(value());
+        else if (arg == "--photon-radius") opts.photon_radius = std::stof(value());
+        else if (arg == "--photon-alpha") opts.photon_alpha = std::stof(value());
+        else if (arg == "--guiding") opts.guiding = true;
+        else if (arg == "--traversal") { std::string v = value(); opts.traversal = v == "scanline" ? TRAVERSAL_SCANLINE : v == "morton" ? TRAVERSAL_MORTON : v == "hilbert" ? TRAVERSAL_HILBERT : throw std::runtime_error("--traversal must be scanline, morton or hilbert"); }
+        else if (arg == "--guide-cell") opts.guide_cell_size = std::stof(value());
+        else if (arg == "--projection") { std::string v = value(); opts.projection = v == "pinhole" ? PROJ_PINHOLE : v == "equirect" ? PROJ_EQUIRECT : v == "cube" ? PROJ_CUBE_FACE : throw std::runtime_error("--projection must be pinhole, equirect or cube"); }
+        else if (arg == "--help" || arg == "-h") { printUsage(); exit(0); }
+        else throw std::runtime_error("Unknown option: " + arg);
+    }
+    if (opts.reference_device != "gpu" && opts.reference_device != "cpu") throw std::runtime_error("--reference-device must be gpu or cpu");
+    if (opts.scenes.empty()) for (const auto& b : BENCHMARK_SCENES) opts.scenes.push_back(b.name);
+    for (const auto& name : opts.scenes) if (!findBenchmarkScene(name)) throw std::runtime_error("Unknown scene: " + name);
+    if (opts.trials < 1 || opts.frames < 1) throw std::runtime_error("--trials and --frames must be positive");
+    if (opts.tile_format != "u8" && opts.tile_format != "f32") throw std::runtime_error("--tile-format must be u8 or f32");
+    if (opts.projection != PROJ_PINHOLE && opts.convergence) throw std::runtime_error("--convergence references are pinhole renders; drop --projection");
+    if (opts.projection == PROJ_CUBE_FACE && (opts.tiled_width || opts.render || opts.benchmark || !opts.submit_socket.empty())) throw std::runtime_error("--projection cube renders a batch of faces; it only combines with --views or --turntable");
+    if (opts.projection == PROJ_CUBE_FACE && opts.width != opts.height) throw std::runtime_error("Cube faces are square; give --size NxN");
+    if ((opts.direct == DIRECT_RESTIR || opts.restir_gi) && (opts.projection != PROJ_PINHOLE || opts.batch() || opts.tiled_width || !opts.serve_socket.empty())) throw std::runtime_error("ReSTIR keeps per-pixel history of one full-frame pinhole view; it does not combine with --projection, batches, --tiled or --serve");
+    // Its reservoirs carry over from sample to sample and are in no accumulation file, so a
+    // render restarted from a checkpoint or split into ranges would differ from one whole run.
+    if ((opts.direct == DIRECT_RESTIR || opts.restir_gi) && (opts.resume || opts.slice_count > 1 || opts.sample_count || opts.spawn > 0)) throw std::runtime_error("ReSTIR history is not saved with the samples; renders using it cannot be resumed or split with --resume, --slice, --samples or --spawn");
+    if ((opts.direct == DIRECT_RESTIR || opts.restir_gi) && opts.render) opts.checkpoint_interval = 0.0; // nothing to resume from
+    if (opts.direct != DIRECT_BSDF && opts.convergence && opts.reference_device == "cpu") throw std::runtime_error("The CPU tracer has no light sampling; use --reference-device gpu with --direct");
+    if (opts.caustics != CAUSTICS_PATH && opts.convergence && opts.reference_device == "cpu") throw std::runtime_error("The CPU tracer has no photon map; use --reference-device gpu with --caustics");
+    if (opts.photon_count < 1 || opts.photon_radius <= 0.0f || opts.photon_alpha <= 0.0f || opts.photon_alpha >= 1.0f) throw std::runtime_error("--photons and --photon-radius must be positive and --photon-alpha in (0, 1)");
+    if (opts.guiding && opts.convergence && opts.reference_device == "cpu") throw std::runtime_error("The CPU tracer has no path guiding; use --reference-device gpu with --guiding");
+    if (opts.guide_cell_size <= 0.0f) throw std::runtime_error("--guide-cell must be positive");
+    if (opts.governor && !opts.replay_file.empty()) throw std::runtime_error("--governor adapts to the device; a replay renders the recording at full quality");
+    if (opts.governor_spp < 1 || (opts.governor_spp & (opts.governor_spp - 1))) throw std::runtime_error("--governor-spp must be a power of two");
+    if (opts.governor && opts.max_fps <= 0.0) opts.max_fps = 30.0;
+    if (!(opts.render_scale >= 0.25f && opts.render_scale <= 1.0f)) throw std::runtime_error("--render-scale must be between 0.25 and 1");
+    if (!(opts.sharpness >= 0.0f)) throw std::runtime_error("--sharpness must not be negative");
+    if (opts.upscale == UPSCALE_TAAU && opts.projection != PROJ_PINHOLE) throw std::runtime_error("--upscale taau reprojects pinhole cameras only");
+    if (opts.ring_slots < 2) throw std::runtime_error("--ring-slots must be at least 2");
+    if (opts.out.empty()) opts.out = !opts.consume_ring.empty() ? "latest.ppm" : !opts.submit_socket.empty() ? "frame.pfm" : opts.batch() ? "views.pfm" : opts.tiled_width ? "poster.tif" : opts.render ? "render.hrta" : opts.benchmark ? "benchmark" : "convergence";
+    if (!opts.merge_output.empty() && opts.merge_inputs.empty()) throw std::runtime_error("--merge needs at least one input file or directory");
+    return opts;
+}
+
+
+// --- Time-to-Quality Benchmark ---
+// Renders (or loads) a high-spp reference per scene, then runs the progressive renderer from
+// scratch and records image error against render time at power-of-two sample counts.
+struct ConvergencePoint { int spp; double elapsed_ms; ImageError error; };
+
+std::vector<float> loadOrRenderReference(const Options& opts, const BenchmarkScene& bench, const Scene& scene, const PathTracer& tracer) {
+    std::filesystem::create_directories(opts.reference_dir);
+    std::string path = opts.reference_dir + "/ref_" + bench.name + "_" + std::to_string(opts.width) + "x" + std::to_string(opts.height) + "_" + std::to_string(opts.reference_spp) + "spp_" + opts.reference_device + (opts.direct != DIRECT_BSDF ? "_nee" : "") + (opts.caustics != CAUSTICS_PATH ? "_ppm" : "") + ".pfm";
+    int w, h; std::vector<float> rgb;
+    if (readPFM(path, w, h, rgb) && w == opts.width && h == opts.height) { std::cout << "  reference: " << path << " (cached)\n"; return rgb; }
+
+    auto start = std::chrono::steady_clock::now();
+    if (opts.reference_device == "cpu") {
+        std::cout << "  CPU reference on " << cpuPool().describe() << ", " << TRAVERSAL_NAMES[opts.traversal] << " order\n";
+        rgb = CpuTracer(scene).render(bench.camera, opts.width, opts.height, opts.reference_spp, opts.traversal);
+    } else {
+        AccumulationTarget target; target.create(opts.width, opts.height);
+        PathTracer reference_tracer = tracer; // references are full path traces, never cached or reused across pixels
+        reference_tracer.radiance_cache = false;
+        if (tracer.direct == DIRECT_RESTIR) reference_tracer.direct = DIRECT_NEE;
+        reference_tracer.restir_gi = false;
+        reference_tracer.guide = nullptr;
+        // Caustics by progressive photon mapping, which converges to the path-traced image.
+        if (tracer.caustics != CAUSTICS_PATH) { reference_tracer.caustics = CAUSTICS_PROGRESSIVE; reference_tracer.photon_first_sample = 1u << 20; }
+        // Offset the sample indices so the reference never shares seeds with the measured run.
+        for (int s = 0; s < opts.reference_spp; ++s) { reference_tracer.renderSample(target, bench.camera, (1u << 20) + s); if (s % 64 == 63) glFinish(); }
+        rgb = resolveAccumulation(target.readback());
+        target.release();
+    }
+    writePFM(path, opts.width, opts.height, rgb);
+    std::cout << "  reference: " << path << " (" << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s)\n";
+    return rgb;
+}
+
+std::vector<ConvergencePoint> measureConvergence(const Options& opts, const BenchmarkScene& bench, const std::vector<float>& reference, PathTracer& tracer) {
+    std::vector<ConvergencePoint> curve;
+    AccumulationTarget target; target.create(opts.width, opts.height);
+    glFinish();
+    double elapsed_ms = 0.0;
+    int next_record = 1;
+    for (int spp = 1; spp <= opts.max_spp; ++spp) {
+        auto start = std::chrono::steady_clock::now();
+        tracer.renderSample(target, bench.camera, spp - 1);
+        glFinish();
+        elapsed_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        bool out_of_time = elapsed_ms >= opts.time_budget * 1000.0;
+        if (spp == next_record || spp == opts.max_spp || out_of_time) {
+            // Readback and metric evaluation are not counted as render time.
+            ImageError err = computeImageError(reference, resolveAccumulation(target.readback()), opts.width, opts.height);
+            curve.push_back({spp, elapsed_ms, err});
+            std::cout << "  " << spp << " spp  " << elapsed_ms << " ms  rmse " << err.rmse << "  relmse " << err.relmse << "  flip " << err.flip << "\n";
+            next_record *= 2;
+        }
+        if (out_of_time) break;
+    }
+    target.release();
+    return curve;
+}
+
+int runConvergenceBenchmark(const Options& opts, PathTracer& tracer) {
+    std::ofstream csv(opts.out + ".csv"), json(opts.out + ".json");
+    if (!csv || !json) throw std::runtime_error("Cannot write " + opts.out + ".csv/.json");
+    csv << "scene,spp,elapsed_ms,rmse,relmse,flip\n";
+    json << "{\n  \"width\": " << opts.width << ", \"height\": " << opts.height << ", \"reference_spp\": " << opts.reference_spp << ", \"reference_device\": \"" << opts.reference_device << "\",\n  \"scenes\": [";
+
+    for (size_t i = 0; i < opts.scenes.size(); ++i) {
+        const BenchmarkScene& bench = *findBenchmarkScene(opts.scenes[i]);
+        std::cout << "Scene " << bench.name << "\n";
+        Scene scene; bench.build(scene);
+        SceneBuffers buffers; buffers.upload(scene);
+        std::vector<float> reference = loadOrRenderReference(opts, bench, scene, tracer);
+        std::vector<ConvergencePoint> curve = measureConvergence(opts, bench, reference, tracer);
+        buffers.release();
+
+        json << (i ? "," : "") << "\n    {\"name\": \"" << bench.name << "\", \"curve\": [";
+        for (size_t j = 0; j < curve.size(); ++j) {
+            const ConvergencePoint& p = curve[j];
+            csv << bench.name << "," << p.spp << "," << p.elapsed_ms << "," << p.error.rmse << "," << p.error.relmse << "," << p.error.flip << "\n";
+            json << (j ? ", " : "") << "\n      {\"spp\": " << p.spp << ", \"elapsed_ms\": " << p.elapsed_ms << ", \"rmse\": " << p.error.rmse << ", \"relmse\": " << p.error.relmse << ", \"flip\": " << p.error.flip << "}";
+        }
+        json << "\n    ]}";
+    }
+    json << "\n  ]\n}\n";
+    std::cout << "Wrote " << opts.out << ".csv and " << opts.out << ".json\n";
+    return 0;
+}
+
+
+// --- Frame-Time Benchmark ---
+// Times single-sample frames of each benchmark scene with GPU timer queries. Every trial is
+// reduced to its median so the comparison below works on independent samples, not on
+// autocorrelated frames.
+double median(std::vector<double> v) { std::sort(v.begin(), v.end()); size_t n = v.size(); return n == 0 ? 0.0 : (n % 2 ? v[n / 2] : 0.5 * (v[n / 2 - 1] + v[n / 2])); }
+
+int runFrameTimeBenchmark(const Options& opts, PathTracer& tracer) {
+    std::ofstream json(opts.out + ".json");
+    if (!json) throw std::runtime_error("Cannot write " + opts.out + ".json");
+    json << "{\n  \"width\": " << opts.width << ", \"height\": " << opts.height << ", \"trials\": " << opts.trials << ", \"frames\": " << opts.frames << ", \"traversal\": \"" << TRAVERSAL_NAMES[opts.traversal] << "\",\n  \"scenes\": [";
+    GLuint query; glGenQueries(1, &query);
+    AccumulationTarget target; target.create(opts.width, opts.height);
+
+    for (size_t i = 0; i < opts.scenes.size(); ++i) {
+        const BenchmarkScene& bench = *findBenchmarkScene(opts.scenes[i]);
+        Scene scene; bench.build(scene);
+        SceneBuffers buffers; buffers.upload(scene);
+        std::vector<double> trial_medians;
+        json << (i ? "," : "") << "\n    {\"name\": \"" << bench.name << "\", \"trials_ms\": [";
+        for (int trial = 0; trial < opts.trials; ++trial) {
+            if (trial && opts.cooldown > 0.0) SDL_Delay((Uint32)(opts.cooldown * 1000.0));
+            target.clear();
+            for (int f = 0; f < opts.warmup_frames; ++f) tracer.renderSample(target, bench.camera, f);
+            glFinish();
+            std::vector<double> frame_ms;
+            for (int f = 0; f < opts.frames; ++f) {
+                glBeginQuery(GL_TIME_ELAPSED, query);
+                tracer.renderSample(target, bench.camera, opts.warmup_frames + f);
+                glEndQuery(GL_TIME_ELAPSED);
+                GLuint64 ns = 0; glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+                frame_ms.push_back(ns / 1e6);
+            }
+            trial_medians.push_back(median(frame_ms));
+            json << (trial ? ", " : "") << trial_medians.back();
+        }
+        json << "]}";
+        buffers.release();
+        std::cout << bench.name << ": median " << median(trial_medians) << " ms/frame over " << opts.trials << " trials\n";
+    }
+    json << "\n  ]\n}\n";
+    target.release(); glDeleteQueries(1, &query);
+    std::cout << "Wrote " << opts.out << ".json\n";
+    return 0;
+}
+
+
+// --- Benchmark Comparison ---
+// Two-sided Mann-Whitney U test (normal approximation with tie and continuity correction).
+double mannWhitneyPValue(const std::vector<double>& a, const std::vector<double>& b) {
+    std::vector<std::pair<double, int>> all;
+    for (double v : a) all.push_back({v, 0});
+    for (double v : b) all.push_back({v, 1});
+    std::sort(all.begin(), all.end());
+    double n1 = a.size(), n2 = b.size(), n = n1 + n2, rank_sum_a = 0.0, tie_term = 0.0;
+    for (size_t i = 0; i < all.size();) {
+        size_t j = i; while (j < all.size() && all[j].first == all[i].first) ++j;
+        double rank = 0.5 * (i + j + 1), t = (double)(j - i); // average of ranks i+1..j
+        for (size_t k = i; k < j; ++k) if (all[k].second == 0) rank_sum_a += rank;
+        tie_term += t * t * t - t;
+        i = j;
+    }
+    double u = rank_sum_a - n1 * (n1 + 1) / 2.0, mean = n1 * n2 / 2.0;
+    double sigma = std::sqrt(n1 * n2 / 12.0 * ((n + 1) - tie_term / (n * (n - 1))));
+    if (sigma <= 0.0) return 1.0;
+    double z = std::max(0.0, std::abs(u - mean) - 0.5) / sigma;
+    return std::erfc(z / std::sqrt(2.0));
+}
+
+// Percentile bootstrap of median(b) / median(a); returns the two-sided (1 - alpha) interval.
+std::pair<double, double> bootstrapMedianRatio(const std::vector<double>& a, const std::vector<double>& b, double alpha, int resamples = 10000) {
+    std::mt19937 rng(12345); // fixed so repeated comparisons print the same interval
+    std::vector<double> ratios, ra(a.size()), rb(b.size());
+    for (int r = 0; r < resamples; ++r) {
+        for (auto& v : ra) v = a[rng() % a.size()];
+        for (auto& v : rb) v = b[rng() % b.size()];
+        ratios.push_back(median(rb) / median(ra));
+    }
+    std::sort(ratios.begin(), ratios.end());
+    auto at = [&](double q) { return ratios[std::min(ratios.size() - 1, (size_t)(q * ratios.size()))]; };
+    return {at(alpha / 2.0), at(1.0 - alpha / 2.0)};
+}
+
+int runBenchmarkComparison(const Options& opts) {
+    JsonValue base = JsonParser::parseFile(opts.compare_files[0]), next = JsonParser::parseFile(opts.compare_files[1]);
+    auto trialsOf = [](const JsonValue& scene) { std::vector<double> v; for (const auto& t : scene["trials_ms"].array) v.push_back(t.number); return v; };
+    std::map<std::string, std::vector<double>> base_trials;
+    for (const auto& scene : base["scenes"].array) base_trials[scene["name"].string] = trialsOf(scene);
+
+    int regressions = 0;
+    std::cout << std::left << std::setw(12) << "scene" << std::setw(12) << "base ms" << std::setw(12) << "new ms" << std::setw(10) << "change" << std::setw(24) << "ratio CI" << std::setw(10) << "p" << "verdict\n";
+    for (const auto& scene : next["scenes"].array) {
+        const std::string& name = scene["name"].string;
+        if (!base_trials.count(name)) { std::cout << std::setw(12) << name << "not in baseline\n"; continue; }
+        std::vector<double> a = base_trials[name], b = trialsOf(scene);
+        if (a.size() < 2 || b.size() < 2) { std::cout << std::setw(12) << name << "needs at least 2 trials per run\n"; continue; }
+        double p = mannWhitneyPValue(a, b);
+        auto ci = bootstrapMedianRatio(a, b, opts.alpha);
+        double ma = median(a), mb = median(b);
+        // Significant in rank test, and the whole interval lies beyond the noise threshold.
+        const char* verdict = "no change";
+        if (p < opts.alpha && ci.first > 1.0 + opts.threshold) { verdict = "REGRESSION"; ++regressions; }
+        else if (p < opts.alpha && ci.second < 1.0 - opts.threshold) verdict = "improvement";
+        std::ostringstream change, interval;
+        change << std::showpos << std::fixed << std::setprecision(1) << (mb / ma - 1.0) * 100.0 << "%";
+        interval << std::fixed << std::setprecision(3) << "[" << ci.first << ", " << ci.second << "]";
+        std::cout << std::setw(12) << name << std::fixed << std::setprecision(3) << std::setw(12) << ma << std::setw(12) << mb << std::setw(10) << change.str() << std::setw(24) << interval.str() << std::defaultfloat << std::setw(10) << p << verdict << "\n";
+    }
+    if (regressions) std::cout << regressions << " significant regression(s)\n";
+    return regressions ? 1 : 0;
+}
+
+
+// --- Offline and Distributed Rendering ---
+// --render takes samples [start, start + count) of one scene headlessly and writes an
+// accumulation file. Several processes (local via --spawn, or one per node sharing a
+// directory) each render a disjoint slice, and --merge adds the slices together.
+struct SampleRange { uint32_t start, count; };
+
+SampleRange renderSampleRange(const Options& opts) {
+    if (opts.sample_count) return {opts.sample_start, opts.sample_count};
+    uint32_t begin = (uint32_t)((uint64_t)opts.spp * opts.slice_index / opts.slice_count);
+    uint32_t end = (uint32_t)((uint64_t)opts.spp * (opts.slice_index + 1) / opts.slice_count);
+    return {begin, end - begin};
+}
+
+// Checkpoints are accumulation files of the samples finished so far. Since the RNG state of a
+// sample is a pure function of (pixel, sample index, seed), the header's sample range is all
+// the RNG state there is; --resume validates it against the job and continues after it.
+// Parts and checkpoints of one render must also share its estimator: the radiance cache and
+// photon maps are biased differently per setting, and the others change which samples a
+// sample index stands for. Settings at their defaults leave the hash of plain path tracing.
+uint64_t renderHash(const Scene& scene, const Camera& camera, const PathTracer& tracer) {
+    uint64_t h = sceneHash(scene, camera, tracer.projection);
+    auto mix = [&h](const auto& value) { h = hashBytes(&value, sizeof(value), h); };
+    if (tracer.direct != DIRECT_BSDF) mix((int)tracer.direct);
+    if (tracer.restir_gi) mix((int)1);
+    if (tracer.radiance_cache) mix(tracer.cache_cell_pixels);
+    if (tracer.caustics != CAUSTICS_PATH) { mix((int)tracer.caustics); mix(tracer.photon_count); mix(tracer.photon_radius); mix(tracer.photon_first_sample); if (tracer.caustics == CAUSTICS_PROGRESSIVE) mix(tracer.photon_alpha); }
+    if (tracer.guide) mix(tracer.guide_cell_size);
+    return h;
+}
+
+volatile sig_atomic_t stop_requested = 0;
+void requestStop(int) { stop_requested = 1; }
+
+int runOfflineRender(const Options& opts, PathTracer& tracer) {
+    const BenchmarkScene& bench = *findBenchmarkScene(opts.scenes.front());
+    SampleRange range = renderSampleRange(opts);
+    Scene scene; bench.build(scene);
+    SceneBuffers buffers; buffers.upload(scene);
+    AccumulationTarget target; target.create(opts.width, opts.height);
+    const uint64_t scene_hash = renderHash(scene, bench.camera, tracer);
+    const std::string checkpoint_path = opts.checkpoint.empty() ? opts.out + ".ckpt" : opts.checkpoint;
+
+    uint32_t done = 0;
+    if (opts.resume && std::filesystem::exists(checkpoint_path)) {
+        AccumulationFile ckpt = readAccumulationFile(checkpoint_path);
+        const AccumulationHeader& h = ckpt.header;
+        if ((int)h.width != opts.width || (int)h.height != opts.height || h.seed != tracer.seed || h.scene_hash != scene_hash || h.sample_start != range.start || h.sample_count > range.count)
+            throw std::runtime_error("Checkpoint " + checkpoint_path + " belongs to a different render");
+        target.upload(ckpt.rgba);
+        done = h.sample_count;
+        std::cout << "Resuming from " << checkpoint_path << " at sample " << range.start + done << "\n";
+    }
+
+    signal(SIGTERM, requestStop); signal(SIGINT, requestStop);
+    AsyncReadback readback;
+    uint32_t readback_samples = 0;
+    // The disk write runs on a worker. A failed checkpoint (a full disk, say) is reported here
+    // on the render thread and the render goes on; the previous checkpoint stays in place.
+    std::future<void> writer;
+    auto collectCheckpoint = [&]() {
+        if (!writer.valid()) return;
+        try { writer.get(); } catch (const std::exception& e) { std::cerr << "Checkpoint failed: " << e.what() << "\n"; }
+    };
+    auto writeCheckpoint = [&](std::vector<float>&& rgba, uint32_t samples) {
+        collectCheckpoint();
+        writer = std::async(std::launch::async, [&, rgba = std::move(rgba), samples]() mutable {
+            writeAccumulationFile(checkpoint_path, {makeAccumulationHeader(opts.width, opts.height, tracer.seed, range.start, samples, scene_hash), std::move(rgba)});
+        });
+    };
+
+    auto start = std::chrono::steady_clock::now(), last_checkpoint = start;
+    for (; done < range.count && !stop_requested; ++done) {
+        tracer.renderSample(target, bench.camera, range.start + done);
+        if (done % 16 == 15) glFinish(); // keep the queue short; mobile drivers kill long submissions
+
+        // The copy is queued behind the samples rendered so far and collected a few samples
+        // later, once its fence has passed; the disk write happens on a worker thread.
+        std::vector<float> rgba;
+        if (readback.pending() && readback.poll(rgba)) writeCheckpoint(std::move(rgba), readback_samples);
+        if (opts.checkpoint_interval > 0.0 && !readback.pending() && std::chrono::duration<double>(std::chrono::steady_clock::now() - last_checkpoint).count() >= opts.checkpoint_interval) {
+            readback.start(target);
+            readback_samples = done + 1;
+            last_checkpoint = std::chrono::steady_clock::now();
+        }
+    }
+    std::vector<float> rgba;
+    if (readback.pending()) readback.poll(rgba, true);
+    readback.release();
+    collectCheckpoint();
+
+    if (stop_requested) {
+        // Preempted: save everything finished so far and leave the job resumable.
+        if (opts.checkpoint_interval > 0.0) writeAccumulationFile(checkpoint_path, {makeAccumulationHeader(opts.width, opts.height, tracer.seed, range.start, done, scene_hash), target.readback()});
+        std::cout << "Interrupted after " << done << " of " << range.count << " samples\n";
+        target.release(); buffers.release();
+        return 1;
+    }
+
+    AccumulationFile file{makeAccumulationHeader(opts.width, opts.height, tracer.seed, range.start, range.count, scene_hash), target.readback()};
+    writeAccumulationFile(opts.out, file);
+    if (std::filesystem::exists(checkpoint_path)) std::filesystem::remove(checkpoint_path);
+    std::cout << "Rendered samples [" << range.start << ", " << range.start + range.count << ") of " << bench.name << " in " << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s -> " << opts.out << "\n";
+
+    target.release(); buffers.release();
+    return 0;
+}
+
+// Inputs may be files or directories (every *.hrta inside). With expect_parts set, waits
+// until that many parts are present, which is how a merger on a shared filesystem
+// waits for the other nodes.
+std::vector<std::string> collectAccumulationFiles(const std::vector<std::string>& inputs, int expect_parts, double timeout) {
+    auto start = std::chrono::steady_clock::now();
+    while (true) {
+        std::vector<std::string> files;
+        for (const auto& input : inputs) {
+            if (!std::filesystem::is_directory(input)) { if (std::filesystem::exists(input)) files.push_back(input); continue; }
+            for (const auto& entry : std::filesystem::directory_iterator(input)) if (entry.path().extension() == ".hrta") files.push_back(entry.path().string());
+        }
+        std::sort(files.begin(), files.end());
+        if ((expect_parts == 0 && !files.empty()) || (expect_parts > 0 && (int)files.size() >= expect_parts)) return files;
+        if (std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() > timeout) throw std::runtime_error("Timed out waiting for " + std::to_string(expect_parts) + " accumulation files, found " + std::to_string(files.size()));
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    }
+}
+
+AccumulationFile mergeAccumulationFiles(const std::vector<std::string>& paths) {
+    AccumulationFile merged = readAccumulationFile(paths.front());
+    std::vector<SampleRange> ranges{{merged.header.sample_start, merged.header.sample_count}};
+    std::vector<double> sum(merged.rgba.begin(), merged.rgba.end());
+    for (size_t i = 1; i < paths.size(); ++i) {
+        AccumulationFile part = readAccumulationFile(paths[i]);
+        const AccumulationHeader &a = merged.header, &b = part.header;
+        if (a.width != b.width || a.height != b.height || a.seed != b.seed || a.scene_hash != b.scene_hash) throw std::runtime_error(paths[i] + " was rendered with a different scene, camera, size, seed or estimator");
+        ranges.push_back({b.sample_start, b.sample_count});
+        for (size_t k = 0; k < sum.size(); ++k) sum[k] += part.rgba[k];
+    }
+    // Overlapping ranges would count the same samples twice.
+    std::sort(ranges.begin(), ranges.end(), [](const SampleRange& x, const SampleRange& y) { return x.start < y.start; });
+    uint32_t total = 0;
+    for (size_t i = 0; i < ranges.size(); ++i) {
+        if (i && ranges[i].start < ranges[i - 1].start + ranges[i - 1].count) throw std::runtime_error("Accumulation files have overlapping sample ranges");
+        total += ranges[i].count;
+    }
+    for (size_t k = 0; k < sum.size(); ++k) merged.rgba[k] = (float)sum[k];
+    // The merged range is only contiguous when the parts tile it; sample_count stays exact either way.
+    merged.header.sample_start = ranges.front().start; merged.header.sample_count = total;
+    return merged;
+}
+
+int runMerge(const Options& opts) {
+    std::vector<std::string> files = collectAccumulationFiles(opts.merge_inputs, opts.expect_parts, opts.merge_timeout);
+    AccumulationFile merged = mergeAccumulationFiles(files);
+    const std::string& out = opts.merge_output;
+    if (std::filesystem::path(out).extension() == ".pfm") writePFM(out, merged.header.width, merged.header.height, resolveAccumulation(merged.rgba));
+    else writeAccumulationFile(out, merged);
+    std::cout << "Merged " << files.size() << " parts, " << merged.header.sample_count << " samples per pixel -> " << out << "\n";
+    return 0;
+}
+
+// The command line of everything that decides what a --render computes, for the processes
+// that render its parts. Floats are written with enough digits to parse back exactly.
+std::vector<std::string> renderArguments(const Options& opts) {
+    auto real = [](float v) { std::ostringstream s; s << std::setprecision(9) << v; return s.str(); };
+    const char* projections[] = {"pinhole", "equirect", "cube"};
+    const char* directs[] = {"bsdf", "nee", "restir"};
+    const char* caustics[] = {"path", "photons", "progressive"};
+    const char* traversals[] = {"scanline", "morton", "hilbert"};
+    std::vector<std::string> args = {"--render", "--scene", opts.scenes.front(), "--size", std::to_string(opts.width) + "x" + std::to_string(opts.height),
+                                     "--seed", std::to_string(opts.seed), "--spp", std::to_string(opts.spp), "--projection", projections[opts.projection],
+                                     "--direct", directs[opts.direct], "--caustics", caustics[opts.caustics], "--photons", std::to_string(opts.photon_count),
+                                     "--photon-radius", real(opts.photon_radius), "--photon-alpha", real(opts.photon_alpha),
+                                     "--cache-cell", real(opts.cache_cell_pixels), "--guide-cell", real(opts.guide_cell_size), "--traversal", traversals[opts.traversal]};
+    if (opts.restir_gi) args.push_back("--restir-gi");
+    if (opts.radiance_cache) args.push_back("--radiance-cache");
+    if (opts.guiding) args.push_back("--guiding");
+    return args;
+}
+
+// Local stand-in for a cluster: runs --slice k/N of this render in N child processes of the
+// same binary, then merges their parts.
+int runLocalSpawn(const Options& opts) {
+    std::vector<pid_t> children;
+    std::vector<std::string> parts;
+    for (int k = 0; k < opts.spawn; ++k) {
+        parts.push_back(opts.out + ".part" + std::to_string(k) + ".hrta");
+        std::vector<std::string> args = renderArguments(opts);
+        args.insert(args.begin(), "/proc/self/exe");
+        args.insert(args.end(), {"--slice", std::to_string(k) + "/" + std::to_string(opts.spawn), "--out", parts.back()});
+        pid_t pid = fork();
+        if (pid < 0) throw std::runtime_error("fork failed");
+        if (pid == 0) {
+            std::vector<char*> argv;
+            for (auto& a : args) argv.push_back(&a[0]);
+            argv.push_back(nullptr);
+            execv(argv[0], argv.data());
+            _exit(127);
+        }
+        children.push_back(pid);
+    }
+    bool failed = false;
+    for (pid_t pid : children) { int status = 0; waitpid(pid, &status, 0); failed |= !WIFEXITED(status) || WEXITSTATUS(status) != 0; }
+    if (failed) throw std::runtime_error("A render process failed");
+
+    Options merge = opts;
+    merge.merge_inputs = parts; merge.merge_output = opts.out; merge.expect_parts = 0;
+    int result = runMerge(merge);
+    for (const auto& part : parts) std::filesystem::remove(part);
+    return result;
+}
+
+
+// --- Tiled Rendering ---
+// Renders an image of any size one tile at a time: each tile is a small accumulation target
+// covering its window of the full image, converged to --spp and streamed into the TIFF
+// before the next one starts. Edge tiles are rendered at full size; TIFF readers ignore
+// the padding.
+int runTiledRender(const Options& opts, PathTracer& tracer) {
+    const BenchmarkScene& bench = *findBenchmarkScene(opts.scenes.front());
+    Scene scene; bench.build(scene);
+    SceneBuffers buffers; buffers.upload(scene);
+    const int T = opts.tile_size;
+    TiledTiffWriter tiff(opts.out, opts.tiled_width, opts.tiled_height, T, opts.tile_format == "f32" ? TiledTiffWriter::F32 : TiledTiffWriter::U8);
+    AccumulationTarget target; target.create(T, T);
+    std::vector<float> rgb((size_t)T * T * 3);
+
+    auto start = std::chrono::steady_clock::now();
+    const int total = tiff.tilesX() * tiff.tilesY();
+    for (int ty = 0; ty < tiff.tilesY(); ++ty) {
+        for (int tx = 0; tx < tiff.tilesX(); ++tx) {
+            // TIFF tiles count from the top, GL rows from the bottom.
+            target.setRegion(tx * T, opts.tiled_height - (ty + 1) * T, opts.tiled_width, opts.tiled_height);
+            target.clear();
+            for (int s = 0; s < opts.spp; ++s) { tracer.renderSample(target, bench.camera, s); if (s % 16 == 15) glFinish(); }
+            std::vector<float> mean = resolveAccumulation(target.readback());
+            for (int row = 0; row < T; ++row) std::copy_n(&mean[(size_t)(T - 1 - row) * T * 3], T * 3, &rgb[(size_t)row * T * 3]);
+            tiff.writeTile(tx, ty, rgb);
+            std::cout << "\rTile " << ty * tiff.tilesX() + tx + 1 << "/" << total << std::flush;
+        }
+    }
+    tiff.finish();
+    std::cout << "\n" << opts.tiled_width << "x" << opts.tiled_height << " at " << opts.spp << " spp in " << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s -> " << opts.out << "\n";
+    target.release(); buffers.release();
+    return 0;
+}
+
+// --- Batch Multi-View Rendering ---
+// Renders many cameras of one scene together: the cameras sit in an SSBO, the target is a
+// texture array with one layer per view, and each sample of all views is a single instanced
+// draw. Scene buffers, program and state are bound once for the whole batch.
+std::vector<Camera> batchCameras(const Options& opts, const BenchmarkScene& bench) {
+    std::vector<Camera> cameras;
+    if (!opts.views_file.empty()) {
+        // [{"position": [x, y, z], "target": [x, y, z]}, ...], optionally wrapped as {"views": [...]}
+        JsonValue doc = JsonParser::parseFile(opts.views_file);
+        const JsonValue& list = doc.type == JsonValue::Array ? doc : doc["views"];
+        auto vec3 = [&](const JsonValue& v) { if (v.array.size() != 3) throw std::runtime_error(opts.views_file + ": expected [x, y, z]"); return glm::vec3(v.array[0].number, v.array[1].number, v.array[2].number); };
+        for (const JsonValue& view : list.array) cameras.push_back({vec3(view["position"]), vec3(view["target"])});
+    } else if (opts.turntable) {
+        glm::vec3 offset = bench.camera.position - bench.camera.target;
+        float radius = std::sqrt(offset.x * offset.x + offset.z * offset.z), start = std::atan2(offset.z, offset.x);
+        for (int i = 0; i < opts.turntable; ++i) {
+            float angle = start + 6.2831853f * i / opts.turntable;
+            cameras.push_back({bench.camera.target + glm::vec3(radius * std::cos(angle), offset.y, radius * std::sin(angle)), bench.camera.target});
+        }
+    } else cameras.push_back(bench.camera); // a cube map of the scene camera's position
+    if (cameras.empty()) throw std::runtime_error("Batch has no views");
+    return cameras;
+}
+
+// The views are written as one atlas, view 0 at the top left, row by row. Cube maps get one
+// row per camera with the faces in GL order (+X, -X, +Y, -Y, +Z, -Z).
+int runBatchRender(const Options& opts, PathTracer& tracer) {
+    const BenchmarkScene& bench = *findBenchmarkScene(opts.scenes.front());
+    std::vector<Camera> cameras = batchCameras(opts, bench);
+    const int views = (int)cameras.size() * tracer.viewsPerCamera();
+    GLint max_layers = 0; glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &max_layers);
+    if (views > max_layers) throw std::runtime_error("Batch of " + std::to_string(views) + " views exceeds the device limit of " + std::to_string(max_layers));
+    Scene scene; bench.build(scene);
+    SceneBuffers buffers; buffers.upload(scene);
+    AccumulationTarget target; target.create(opts.width, opts.height, views);
+    tracer.setCameras(cameras);
+
+    auto start = std::chrono::steady_clock::now();
+    const int finish_every = std::max(1, 16 / views); // same queue depth as single-view rendering
+    for (int s = 0; s < opts.spp; ++s) { tracer.renderViews(target, views, s); if ((s + 1) % finish_every == 0) glFinish(); }
+    glFinish();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    const int columns = tracer.projection == PROJ_CUBE_FACE ? 6 : (int)std::ceil(std::sqrt((double)views)), rows = (views + columns - 1) / columns;
+    const int atlas_width = columns * opts.width, atlas_height = rows * opts.height;
+    std::vector<float> atlas((size_t)atlas_width * atlas_height * 3, 0.0f);
+    for (int v = 0; v < views; ++v) {
+        std::vector<float> mean = resolveAccumulation(target.readback(v));
+        int x0 = (v % columns) * opts.width, y0 = (rows - 1 - v / columns) * opts.height; // PFM rows run bottom-up
+        for (int y = 0; y < opts.height; ++y) std::copy_n(&mean[(size_t)y * opts.width * 3], opts.width * 3, &atlas[((size_t)(y0 + y) * atlas_width + x0) * 3]);
+    }
+    writePFM(opts.out, atlas_width, atlas_height, atlas);
+    std::cout << views << " views of " << opts.width << "x" << opts.height << " at " << opts.spp << " spp in " << seconds << " s ("
+              << (double)views * opts.width * opts.height * opts.spp / seconds / 1e6 << " Msamples/s) -> " << opts.out << " (" << columns << "x" << rows << " atlas)\n";
+    target.release(); buffers.release();
+    return 0;
+}
+
+// --- Render Server ---
+// --serve keeps one GL context, the compiled program, uploaded scenes and render targets alive
+// and renders jobs sent over a Unix domain socket, so a job costs its render time and nothing
+// else. Requests are fixed-size little-endian records; a client may pipeline any number on one
+// connection. Jobs run by priority (higher first, FIFO within a priority) and each reply carries
+// the frame as a memfd passed with SCM_RIGHTS: width x height RGB float means, bottom row
+// first, ready to mmap.
+const char JOB_MAGIC[4] = {'H', 'R', 'T', 'J'};
+const uint32_t JOB_PROTOCOL_VERSION = 1;
+struct JobRequest {
+    char magic[4]; uint32_t version; uint32_t id; int32_t priority;
+    uint32_t width, height, spp, seed; int32_t projection;
+    float position[3], target[3];
+    char scene[32];
+};
+struct JobReply {
+    uint32_t id; int32_t status; // 0: frame attached; otherwise error says why
+    uint32_t width, height; float queue_ms, render_ms;
+    char error[104];
+};
+
+// Requests are read without blocking into the connection's partial request, so a client that
+// sends half a request delays nobody else. A reply waits at most SEND_TIMEOUT for a client
+// that does not read its replies.
+struct Connection {
+    static constexpr int SEND_TIMEOUT_SECONDS = 5;
+    int fd; std::mutex send_mutex;
+    JobRequest partial; size_t received = 0; // bytes of partial read so far
+    explicit Connection(int fd) : fd(fd) { timeval timeout{SEND_TIMEOUT_SECONDS, 0}; setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)); }
+    ~Connection() { close(fd); }
+    void send(const JobReply& reply, int frame_fd = -1) {
+        iovec iov{const_cast<JobReply*>(&reply), sizeof(reply)};
+        msghdr msg{}; msg.msg_iov = &iov; msg.msg_iovlen = 1;
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+        if (frame_fd >= 0) {
+            msg.msg_control = control; msg.msg_controllen = sizeof(control);
+            cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+            cm->cmsg_level = SOL_SOCKET; cm->cmsg_type = SCM_RIGHTS; cm->cmsg_len = CMSG_LEN(sizeof(int));
+            memcpy(CMSG_DATA(cm), &frame_fd, sizeof(int));
+        }
+        std::lock_guard<std::mutex> lock(send_mutex);
+        sendmsg(fd, &msg, MSG_NOSIGNAL); // a client that went away just misses its reply
+    }
+};
+
+struct Job { JobRequest request; std::shared_ptr<Connection> connection; uint64_t order; std::chrono::steady_clock::time_point received; };
+
+class JobQueue {
+public:
+    void push(Job job) { std::lock_guard<std::mutex> lock(mutex); job.order = next_order++; jobs.push(std::move(job)); ready.notify_one(); }
+    bool pop(Job& job, std::chrono::milliseconds timeout) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!ready.wait_for(lock, timeout, [&] { return !jobs.empty(); })) return false;
+        job = jobs.top(); jobs.pop();
+        return true;
+    }
+private:
+    struct Later { bool operator()(const Job& a, const Job& b) const { return a.request.priority != b.request.priority ? a.request.priority < b.request.priority : a.order > b.order; } };
+    std::mutex mutex; std::condition_variable ready;
+    std::priority_queue<Job, std::vector<Job>, Later> jobs; uint64_t next_order = 0;
+};
+
+JobReply jobError(const JobRequest& request, const std::string& what) { JobReply reply{}; reply.id = request.id; reply.status = 1; snprintf(reply.error, sizeof(reply.error), "%s", what.c_str()); return reply; }
+
+// Limits of one job, so a request cannot queue hours of work or a frame larger than memory.
+const uint32_t MAX_JOB_SPP = 1 << 16, MAX_JOB_PIXELS = 4096 * 4096;
+
+// Why a request cannot be rendered, or empty. Checked before a job is queued; the texture
+// size limit of the GL context is checked when it runs.
+std::string jobRequestError(const JobRequest& r) {
+    std::string scene_name(r.scene, strnlen(r.scene, sizeof(r.scene)));
+    if (!findBenchmarkScene(scene_name)) return "unknown scene " + scene_name;
+    if (!r.width || !r.height || (uint64_t)r.width * r.height > MAX_JOB_PIXELS) return "size must be 1 to " + std::to_string(MAX_JOB_PIXELS) + " pixels";
+    if (!r.spp || r.spp > MAX_JOB_SPP) return "spp must be 1 to " + std::to_string(MAX_JOB_SPP);
+    if (r.projection != PROJ_PINHOLE && r.projection != PROJ_EQUIRECT) return "projection must be pinhole or equirect";
+    return "";
+}
+
+// Reads what a connection has sent and queues every request it completes. Returns false once
+// the connection is closed or has sent something that is not a request.
+bool readRequests(const std::shared_ptr<Connection>& connection, JobQueue& queue) {
+    while (true) {
+        ssize_t n = recv(connection->fd, (char*)&connection->partial + connection->received, sizeof(JobRequest) - connection->received, MSG_DONTWAIT);
+        if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        if (n == 0) return false;
+        if ((connection->received += n) < sizeof(JobRequest)) continue;
+        connection->received = 0;
+        const JobRequest& request = connection->partial;
+        if (memcmp(request.magic, JOB_MAGIC, 4) != 0 || request.version != JOB_PROTOCOL_VERSION) { connection->send(jobError(request, "not a version 1 job request")); return false; }
+        std::string error = jobRequestError(request);
+        if (!error.empty()) connection->send(jobError(request, error));
+        else queue.push({request, connection, 0, std::chrono::steady_clock::now()});
+    }
+}
+
+// Socket thread: accepts clients and queues every complete request. GL stays on the main thread.
+void receiveJobs(int listen_fd, JobQueue& queue) {
+    std::vector<pollfd> fds{{listen_fd, POLLIN, 0}};
+    std::vector<std::shared_ptr<Connection>> connections{nullptr};
+    while (!stop_requested) {
+        if (poll(fds.data(), fds.size(), 200) <= 0) continue;
+        for (size_t i = fds.size(); i-- > 1;) {
+            if (!fds[i].revents) continue;
+            if (!readRequests(connections[i], queue)) { fds.erase(fds.begin() + i); connections.erase(connections.begin() + i); }
+        }
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(listen_fd, nullptr, nullptr);
+            if (fd >= 0) { fds.push_back({fd, POLLIN, 0}); connections.push_back(std::make_shared<Connection>(fd)); }
+        }
+    }
+}
+
+sockaddr_un socketAddress(const std::string& path) {
+    sockaddr_un addr{}; addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) throw std::runtime_error("Socket path too long: " + path);
+    strcpy(addr.sun_path, path.c_str());
+    return addr;
+}
+
+int runServer(const Options& opts, PathTracer& tracer) {
+    sockaddr_un addr = socketAddress(opts.serve_socket);
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    unlink(opts.serve_socket.c_str());
+    if (listen_fd < 0 || bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listen_fd, 16) != 0) throw std::runtime_error("Cannot listen on " + opts.serve_socket + ": " + strerror(errno));
+    signal(SIGTERM, requestStop); signal(SIGINT, requestStop);
+    JobQueue queue;
+    std::thread receiver(receiveJobs, listen_fd, std::ref(queue));
+    std::cout << "Serving on " << opts.serve_socket << "\n" << std::flush;
+
+    // Everything expensive is created on first use and kept: scene buffers per scene, render
+    // targets per size (a few sizes at most, to bound GPU memory).
+    std::map<std::string, SceneBuffers> scenes;
+    std::map<std::pair<int, int>, AccumulationTarget> targets;
+    GLint max_size = 0; glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+    uint64_t served = 0;
+    while (!stop_requested) {
+        Job job;
+        if (!queue.pop(job, std::chrono::milliseconds(200))) continue;
+        const JobRequest& r = job.request;
+        std::string scene_name(r.scene, strnlen(r.scene, sizeof(r.scene)));
+        const BenchmarkScene* bench = findBenchmarkScene(scene_name);
+        if ((GLint)r.width > max_size || (GLint)r.height > max_size) { job.connection->send(jobError(r, "larger than the GPU's texture size " + std::to_string(max_size))); continue; }
+
+        auto start = std::chrono::steady_clock::now();
+        auto scene_it = scenes.find(scene_name);
+        if (scene_it == scenes.end()) { Scene scene; bench->build(scene); scenes[scene_name].upload(scene); }
+        else scene_it->second.bind();
+        std::pair<int, int> size((int)r.width, (int)r.height);
+        if (!targets.count(size) && targets.size() >= 4) { for (auto& t : targets) t.second.release(); targets.clear(); }
+        AccumulationTarget& target = targets[size];
+        if (!target.fbo) target.create(size.first, size.second); else target.clear();
+
+        tracer.seed = r.seed; tracer.projection = (Projection)r.projection;
+        tracer.setCameras({{glm::vec3(r.position[0], r.position[1], r.position[2]), glm::vec3(r.target[0], r.target[1], r.target[2])}});
+        for (uint32_t s = 0; s < r.spp; ++s) { tracer.renderViews(target, 1, s); if (s % 16 == 15) glFinish(); }
+        std::vector<float> rgb = resolveAccumulation(target.readback());
+
+        size_t bytes = rgb.size() * sizeof(float);
+        int frame_fd = memfd_create("raytracer-frame", MFD_CLOEXEC);
+        void* map = frame_fd < 0 || ftruncate(frame_fd, bytes) != 0 ? MAP_FAILED : mmap(nullptr, bytes, PROT_WRITE, MAP_SHARED, frame_fd, 0);
+        if (map == MAP_FAILED) { if (frame_fd >= 0) close(frame_fd); job.connection->send(jobError(r, std::string("shared memory: ") + strerror(errno))); continue; }
+        memcpy(map, rgb.data(), bytes); munmap(map, bytes);
+
+        auto done = std::chrono::steady_clock::now();
+        JobReply reply{}; reply.id = r.id; reply.width = r.width; reply.height = r.height;
+        reply.queue_ms = std::chrono::duration<float, std::milli>(start - job.received).count();
+        reply.render_ms = std::chrono::duration<float, std::milli>(done - start).count();
+        job.connection->send(reply, frame_fd);
+        close(frame_fd);
+        ++served;
+    }
+    receiver.join();
+    close(listen_fd); unlink(opts.serve_socket.c_str());
+    for (auto& t : targets) t.second.release();
+    for (auto& sc : scenes) sc.second.release();
+    std::cout << "Served " << served << " jobs\n";
+    return 0;
+}
+
+// --submit: a reference client. Sends every job before reading any reply, so the server's
+// queue sees them all; frames arrive in the server's priority order.
+int runSubmit(const Options& opts) {
+    const BenchmarkScene& bench = *findBenchmarkScene(opts.scenes.front());
+    std::vector<Camera> cameras = batchCameras(opts, bench);
+    sockaddr_un addr = socketAddress(opts.submit_socket);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) throw std::runtime_error("Cannot connect to " + opts.submit_socket + ": " + strerror(errno));
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < cameras.size(); ++i) {
+        JobRequest request{};
+        memcpy(request.magic, JOB_MAGIC, 4); request.version = JOB_PROTOCOL_VERSION; request.id = (uint32_t)i; request.priority = opts.priority;
+        request.width = opts.width; request.height = opts.height; request.spp = opts.spp; request.seed = opts.seed; request.projection = opts.projection;
+        for (int c = 0; c < 3; ++c) { request.position[c] = cameras[i].position[c]; request.target[c] = cameras[i].target[c]; }
+        snprintf(request.scene, sizeof(request.scene), "%s", bench.name);
+        if (send(fd, &request, sizeof(request), MSG_NOSIGNAL) != (ssize_t)sizeof(request)) throw std::runtime_error("Lost connection to " + opts.submit_socket);
+    }
+    int failed = 0;
+    for (size_t n = 0; n < cameras.size(); ++n) {
+        JobReply reply;
+        iovec iov{&reply, sizeof(reply)};
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+        msghdr msg{}; msg.msg_iov = &iov; msg.msg_iovlen = 1; msg.msg_control = control; msg.msg_controllen = sizeof(control);
+        if (recvmsg(fd, &msg, MSG_WAITALL) != (ssize_t)sizeof(reply)) throw std::runtime_error("Lost connection to " + opts.submit_socket);
+        cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+        int frame_fd = -1;
+        if (cm && cm->cmsg_type == SCM_RIGHTS) memcpy(&frame_fd, CMSG_DATA(cm), sizeof(int));
+        if (reply.status != 0 || frame_fd < 0) { std::cerr << "Job " << reply.id << " failed: " << reply.error << "\n"; ++failed; continue; }
+
+        size_t bytes = (size_t)reply.width * reply.height * 3 * sizeof(float);
+        const float* frame = (const float*)mmap(nullptr, bytes, PROT_READ, MAP_SHARED, frame_fd, 0);
+        close(frame_fd);
+        if (frame == MAP_FAILED) throw std::runtime_error(std::string("Cannot map frame: ") + strerror(errno));
+        std::string path = opts.out;
+        if (cameras.size() > 1) { std::filesystem::path p(opts.out); char index[16]; snprintf(index, sizeof(index), "_%03u", reply.id); path = (p.parent_path() / (p.stem().string() + index + p.extension().string())).string(); }
+        writePFM(path, reply.width, reply.height, std::vector<float>(frame, frame + bytes / sizeof(float)));
+        munmap((void*)frame, bytes);
+        std::cout << "Job " << reply.id << ": queued " << reply.queue_ms << " ms, rendered " << reply.render_ms << " ms, round trip "
+                  << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms -> " << path << "\n";
+    }
+    close(fd);
+    return failed ? 1 : 0;
+}
+
+
+// --- Shared-Memory Frame Delivery ---
+// A frame ring in POSIX shared memory (/dev/shm/NAME) that consumers map and read in place.
+// Layout: FrameRingHeader, slot_count FrameSlotHeaders, then slot_count page-aligned pixel
+// slots of width x height RGBA8, display-encoded, bottom row first. Frame n (from 1) goes to
+// slot n % slot_count. Each slot is a seqlock: its sequence is 2n+1 while frame n is being
+// written and 2n+2 once it is complete, so a reader re-checks it after using the pixels to
+// know they were not overwritten meanwhile. Every publish bumps the notify word and wakes
+// futex waiters on it.
+const char FRAME_RING_MAGIC[4] = {'H', 'R', 'T', 'F'};
+const uint32_t FRAME_RING_VERSION = 1;
+struct FrameRingHeader {
+    char magic[4]; uint32_t version;
+    uint32_t width, height, slot_count;
+    std::atomic<uint32_t> closed;               // the publisher has exited
+    uint64_t slot_bytes, data_offset;
+    std::atomic<uint64_t> latest;               // newest complete frame, 0 before the first
+    std::atomic<uint32_t> notify; uint32_t _padding;
+};
+struct FrameSlotHeader { std::atomic<uint64_t> sequence; uint32_t samples; float time; };
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t) && std::atomic<uint32_t>::is_always_lock_free, "futex word must be a plain 32-bit integer");
+
+void futexWake(std::atomic<uint32_t>* word) { syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0); }
+void futexWait(std::atomic<uint32_t>* word, uint32_t seen, double seconds) {
+    timespec timeout{(time_t)seconds, (long)((seconds - (time_t)seconds) * 1e9)};
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT, seen, &timeout, nullptr, 0);
+}
+std::string shmName(const std::string& name) { return name[0] == '/' ? name : "/" + name; }
+
+class FramePublisher {
+public:
+    FramePublisher(const std::string& name, int width, int height, int slots) : name(shmName(name)) {
+        const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        size_t slot_bytes = ((size_t)width * height * 4 + page - 1) / page * page;
+        size_t data_offset = (sizeof(FrameRingHeader) + slots * sizeof(FrameSlotHeader) + page - 1) / page * page;
+        size = data_offset + slots * slot_bytes;
+        int fd = shm_open(this->name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0600);
+        if (fd < 0 || ftruncate(fd, size) != 0) throw std::runtime_error("Cannot create shared memory " + this->name + ": " + strerror(errno));
+        base = (uint8_t*)mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (base == MAP_FAILED) throw std::runtime_error("Cannot map shared memory " + this->name + ": " + strerror(errno));
+        header = new (base) FrameRingHeader{{}, FRAME_RING_VERSION, (uint32_t)width, (uint32_t)height, (uint32_t)slots, {0}, slot_bytes, data_offset, {0}, {0}, 0};
+        slot_headers = reinterpret_cast<FrameSlotHeader*>(base + sizeof(FrameRingHeader));
+        for (int i = 0; i < slots; ++i) new (&slot_headers[i]) FrameSlotHeader{{0}, 0, 0.0f};
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy(header->magic, FRAME_RING_MAGIC, 4); // last: consumers attach only to a complete header
+    }
+    ~FramePublisher() { header->closed.store(1, std::memory_order_release); header->notify.fetch_add(1); futexWake(&header->notify); munmap(base, size); shm_unlink(name.c_str()); }
+    void publish(const void* rgba8, uint32_t samples, float time) {
+        uint64_t n = ++published;
+        FrameSlotHeader& slot = slot_headers[n % header->slot_count];
+        slot.sequence.store(2 * n + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy(base + header->data_offset + (n % header->slot_count) * header->slot_bytes, rgba8, (size_t)header->width * header->height * 4);
+        slot.samples = samples; slot.time = time;
+        slot.sequence.store(2 * n + 2, std::memory_order_release);
+        header->latest.store(n, std::memory_order_release);
+        header->notify.fetch_add(1, std::memory_order_release);
+        futexWake(&header->notify);
+    }
+private:
+    std::string name; size_t size = 0; uint8_t* base = nullptr;
+    FrameRingHeader* header = nullptr; FrameSlotHeader* slot_headers = nullptr; uint64_t published = 0;
+};
+
+// A reader's view of a mapped ring. Frame n's pixels may be used in place between a true
+// complete(n) and a true unchanged(n); a false unchanged(n) means the publisher overwrote them.
+struct FrameRingView {
+    const uint8_t* base; FrameRingHeader* header; const FrameSlotHeader* slots;
+    explicit FrameRingView(const uint8_t* base) : base(base), header(const_cast<FrameRingHeader*>(reinterpret_cast<const FrameRingHeader*>(base))), slots(reinterpret_cast<const FrameSlotHeader*>(base + sizeof(FrameRingHeader))) {}
+    const FrameSlotHeader& slot(uint64_t n) const { return slots[n % header->slot_count]; }
+    const uint8_t* pixels(uint64_t n) const { return base + header->data_offset + (n % header->slot_count) * header->slot_bytes; }
+    size_t frameBytes() const { return (size_t)header->width * header->height * 4; }
+    bool complete(uint64_t n) const { return slot(n).sequence.load(std::memory_order_acquire) == 2 * n + 2; }
+    bool unchanged(uint64_t n) const { std::atomic_thread_fence(std::memory_order_acquire); return slot(n).sequence.load(std::memory_order_relaxed) == 2 * n + 2; }
+};
+
+void writePPM(const std::string& path, int width, int height, const uint8_t* rgba_bottom_up) {
+    std::ofstream out(path, std::ios::binary);
+    if (!out) throw std::runtime_error("Cannot write " + path);
+    out << "P6\n" << width << " " << height << "\n255\n";
+    for (int y = height - 1; y >= 0; --y) for (int x = 0; x < width; ++x) out.write(reinterpret_cast<const char*>(rgba_bottom_up + ((size_t)y * width + x) * 4), 3);
+}
+
+// --consume: a reference consumer. It sleeps on the futex, looks at the newest frame in place
+// and counts frames the publisher overwrote before they were seen.
+int runConsumer(const Options& opts) {
+    const std::string name = shmName(opts.consume_ring);
+    signal(SIGTERM, requestStop); signal(SIGINT, requestStop);
+    // Wait for the publisher to create and size the ring.
+    int fd = -1; struct stat st{};
+    while (!stop_requested) {
+        if ((fd = shm_open(name.c_str(), O_RDONLY, 0)) >= 0 && fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(FrameRingHeader)) break;
+        if (fd >= 0) { close(fd); fd = -1; }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    if (fd < 0) return 1;
+    const uint8_t* base = (const uint8_t*)mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) throw std::runtime_error("Cannot map shared memory " + name + ": " + strerror(errno));
+    FrameRingView ring(base);
+    FrameRingHeader* header = ring.header;
+    while (memcmp(header->magic, FRAME_RING_MAGIC, 4) != 0 && !stop_requested) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    if (header->version != FRAME_RING_VERSION) throw std::runtime_error(name + " is not a version 1 frame ring");
+    std::cout << "Attached to " << name << ": " << header->width << "x" << header->height << ", " << header->slot_count << " slots\n";
+
+    std::vector<uint8_t> last;
+    uint64_t seen = 0, received = 0, dropped = 0, torn = 0;
+    uint64_t window_frames = 0; auto window_start = std::chrono::steady_clock::now();
+    while (!stop_requested && !header->closed.load(std::memory_order_acquire)) {
+        uint32_t notify = header->notify.load(std::memory_order_acquire);
+        uint64_t n = header->latest.load(std::memory_order_acquire);
+        if (n == seen) { futexWait(&header->notify, notify, 0.5); continue; }
+        if (!ring.complete(n)) { ++torn; continue; }
+        // An encoder or viewer would consume pixels here, in place. This one only keeps a copy
+        // to save at exit, taken once per second.
+        bool keep = last.empty() || window_frames == 0;
+        if (keep) last.assign(ring.pixels(n), ring.pixels(n) + ring.frameBytes());
+        if (!ring.unchanged(n)) { ++torn; if (keep) last.clear(); continue; }
+        if (seen) dropped += n - seen - 1;
+        seen = n; ++received; ++window_frames;
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - window_start).count();
+        if (elapsed >= 1.0) {
+            std::cout << "frame " << n << " (" << ring.slot(n).samples << " spp): " << window_frames / elapsed << " fps, " << dropped << " dropped, " << torn << " torn\n" << std::flush;
+            window_frames = 0; window_start = std::chrono::steady_clock::now();
+        }
+    }
+    std::cout << "Received " << received << " frames, " << dropped << " dropped, " << torn << " torn\n";
+    if (!last.empty()) { writePPM(opts.out, header->width, header->height, last.data()); std::cout << "Last kept frame -> " << opts.out << "\n"; }
+    munmap((void*)base, st.st_size);
+    return 0;
+}
+
+
+// --- Interactive Camera and Scene Editing ---
+// Space pauses the orbit, arrows/PageUp/PageDown move the camera, Tab selects an object,
+// W/A/S/D/Q/E move it and M cycles its material.
+struct SceneEdit { uint32_t object; glm::vec3 position; int32_t material; };
+
+struct OrbitController {
+    float angle = 0.0f, radius = 4.0f, height = 1.5f; bool auto_orbit = true;
+    Camera camera() const { return {glm::vec3(cos(angle) * radius, height, sin(angle) * radius), glm::vec3(0, 0, 0)}; }
+    void update(float dt) { if (auto_orbit) angle += 0.3f * dt; }
+    bool handleKey(SDL_Keycode key) {
+        switch (key) {
+            case SDLK_SPACE: auto_orbit = !auto_orbit; return true;
+            case SDLK_LEFT: angle -= 0.05f; return true;
+            case SDLK_RIGHT: angle += 0.05f; return true;
+            case SDLK_UP: radius = std::max(1.0f, radius - 0.1f); return true;
+            case SDLK_DOWN: radius += 0.1f; return true;
+            case SDLK_PAGEUP: height += 0.1f; return true;
+            case SDLK_PAGEDOWN: height -= 0.1f; return true;
+            default: return false;
+        }
+    }
+};
+
+struct SceneEditor {
+    int selected = 1; // the ground plane is object 0
+    bool handleKey(SDL_Keycode key, const Scene& scene, SceneEdit& edit) {
+        if (key == SDLK_TAB) { selected = (selected + 1) % (int)scene.objects.size(); return false; }
+        const SceneObject* obj = scene.objects[selected];
+        edit = {(uint32_t)selected, obj->position, obj->materialId};
+        const float step = 0.1f;
+        switch (key) {
+            case SDLK_a: edit.position.x -= step; return true;
+            case SDLK_d: edit.position.x += step; return true;
+            case SDLK_w: edit.position.z -= step; return true;
+            case SDLK_s: edit.position.z += step; return true;
+            case SDLK_q: edit.position.y -= step; return true;
+            case SDLK_e: edit.position.y += step; return true;
+            case SDLK_m: edit.material = (obj->materialId + 1) % (int)scene.materials.size(); return true;
+            default: return false;
+        }
+    }
+};
+
+void applySceneEdit(Scene& scene, const SceneEdit& edit) {
+    if (edit.object >= scene.objects.size() || edit.material < 0 || edit.material >= (int)scene.materials.size()) throw std::runtime_error("Scene edit out of range");
+    scene.objects[edit.object]->position = edit.position;
+    scene.objects[edit.object]->materialId = edit.material;
+}
+
+
+// --- Record / Replay ---
+// A recording is a small header (scene, global seed) followed by one record per displayed
+// frame: its index (the sample index the shader seeds from), orbit time, camera, raw key
+// events and the scene edits applied before rendering it. Replay consumes records by frame
+// index, so it never looks at the clock.
+struct InputEvent { uint32_t type; int32_t key; };
+struct FrameRecord {
+    uint32_t frame = 0; float time = 0.0f; Camera camera{};
+    FrameVector<InputEvent> inputs; FrameVector<SceneEdit> edits; // in the arena of the thread that made the record
+};
+
+const char RECORDING_MAGIC[4] = {'H', 'R', 'T', 'R'};
+const uint32_t RECORDING_VERSION = 2;
+
+class FrameRecorder {
+public:
+    FrameRecorder(const std::string& path, const std::string& scene_name, uint32_t seed) : out(path, std::ios::binary) {
+        if (!out) throw std::runtime_error("Cannot write recording " + path);
+        out.write(RECORDING_MAGIC, 4); put(RECORDING_VERSION); put(seed);
+        put((uint32_t)scene_name.size()); out.write(scene_name.data(), scene_name.size());
+    }
+    void write(const FrameRecord& r) {
+        put(r.frame); put(r.time); putVec(r.camera.position); putVec(r.camera.target);
+        put((uint16_t)r.inputs.size()); put((uint16_t)r.edits.size());
+        for (const auto& i : r.inputs) { put(i.type); put(i.key); }
+        for (const auto& e : r.edits) { put(e.object); putVec(e.position); put(e.material); }
+    }
+private:
+    std::ofstream out;
+    template <typename T> void put(T v) { out.write(reinterpret_cast<const char*>(&v), sizeof(T)); }
+    void putVec(const glm::vec3& v) { put(v.x); put(v.y); put(v.z); }
+};
+
+class FramePlayer {
+public:
+    std::string scene_name; uint32_t seed = 0;
+    FramePlayer(const std::string& path) : in(path, std::ios::binary) {
+        char magic[4]; uint32_t version = 0, name_len = 0;
+        if (!in.read(magic, 4) || memcmp(magic, RECORDING_MAGIC, 4) != 0) throw std::runtime_error("Not a recording: " + path);
+        get(version); if (version != RECORDING_VERSION) throw std::runtime_error("Unsupported recording version in " + path);
+        get(seed); get(name_len); scene_name.resize(name_len); in.read(&scene_name[0], name_len);
+    }
+    bool read(FrameRecord& r) {
+        uint16_t n_inputs = 0, n_edits = 0;
+        if (!get(r.frame)) return false;
+        get(r.time); getVec(r.camera.position); getVec(r.camera.target); get(n_inputs); get(n_edits);
+        r.inputs.resize(n_inputs); r.edits.resize(n_edits);
+        for (auto& i : r.inputs) { get(i.type); get(i.key); }
+        for (auto& e : r.edits) { get(e.object); getVec(e.position); get(e.material); }
+        if (!in) throw std::runtime_error("Truncated recording");
+        return true;
+    }
+private:
+    std::ifstream in;
+    template <typename T> bool get(T& v) { return (bool)in.read(reinterpret_cast<char*>(&v), sizeof(T)); }
+    void getVec(glm::vec3& v) { get(v.x); get(v.y); get(v.z); }
+};
+
+
+// --- Progressive Refinement ---
+// After a camera move or scene edit, the viewer shows one frame each at 1/8, 1/4 and 1/2 of
+// the resolution before accumulating at full resolution. Each level starts from the one
+// below it and is upscaled bilinearly for display. The full-resolution accumulation starts
+// clean, so the converged image is unchanged.
+struct RefinementPreview {
+    static const int LEVELS = 3;
+    AccumulationTarget levels[LEVELS]; // levels[i] is 1 / 2^(LEVELS - i) of the full size
+    GLuint program = 0; int next = LEVELS;
+    void create(int width, int height) {
+        program = createShaderProgram(refineShaderSource);
+        for (int i = 0; i < LEVELS; ++i) {
+            levels[i].create(std::max(1, width >> (LEVELS - i)), std::max(1, height >> (LEVELS - i)));
+            glBindTexture(GL_TEXTURE_2D, levels[i].texture);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR); glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE); glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        }
+    }
+    void restart() { next = 0; }
+    bool active() const { return next < LEVELS; }
+    // Renders the next level and returns it for display.
+    const AccumulationTarget& render(PathTracer& tracer, const Camera& camera, uint32_t sample_index) {
+        AccumulationTarget& level = levels[next++];
+        level.clear();
+        if (&level != &levels[0]) {
+            glBindFramebuffer(GL_FRAMEBUFFER, level.fbo);
+            glViewport(0, 0, level.width, level.height);
+            glUseProgram(program);
+            glActiveTexture(GL_TEXTURE0); glBindTexture(GL_TEXTURE_2D, (&level - 1)->texture);
+            tracer.drawQuad();
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        }
+        tracer.renderSample(level, camera, sample_index);
+        return level;
+    }
+    void release() { for (AccumulationTarget& level : levels) if (level.fbo) level.release(); if (program) glDeleteProgram(program); program = 0; }
+};
+
+
+// --- Spatial Upscaling ---
+// Path tracing costs scale with the pixel count. With --render-scale the viewer traces
+// fewer pixels than it shows, then scales the image up to --size. The mean is tone-mapped
+// at render resolution, enlarged by the edge-adaptive EASU filter and sharpened by RCAS,
+// all in 8-bit display encoding. When the sizes match, only RCAS runs. The result is
+// kept in output, which goes to the window and to --publish.
+struct Upscaler {
+    GLuint easu_program = 0, rcas_program = 0;
+    GLint easu_output_size_loc = -1, rcas_sharpness_loc = -1;
+    float sharpness = 1.0f; // exp2(-stops)
+    AccumulationTarget encoded, enlarged, output; // RGBA8: input tone-mapped, after EASU, after RCAS
+    void create(int width, int height, float sharpness_stops) {
+        easu_program = createShaderProgram(easuShaderSource);
+        rcas_program = createShaderProgram(rcasShaderSource);
+        easu_output_size_loc = glGetUniformLocation(easu_program, "u_output_size");
+        rcas_sharpness_loc = glGetUniformLocation(rcas_program, "u_sharpness");
+        sharpness = std::exp2(-sharpness_stops);
+        enlarged.create(width, height, 0, GL_RGBA8); output.create(width, height, 0, GL_RGBA8);
+        glBindTexture(GL_TEXTURE_2D, output.texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR); glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    }
+    const AccumulationTarget& render(const PathTracer& tracer, const AccumulationTarget& target) {
+        if (target.width != encoded.width || target.height != encoded.height) {
+            if (encoded.fbo) encoded.release();
+            encoded.create(target.width, target.height, 0, GL_RGBA8);
+        }
+        tracer.display(target, encoded.width, encoded.height, encoded.fbo);
+        const AccumulationTarget* source = &encoded;
+        if (encoded.width != output.width || encoded.height != output.height) {
+            glBindFramebuffer(GL_FRAMEBUFFER, enlarged.fbo);
+            glViewport(0, 0, enlarged.width, enlarged.height);
+            glUseProgram(easu_program);
+            glUniform2f(easu_output_size_loc, (float)enlarged.width, (float)enlarged.height);
+            glActiveTexture(GL_TEXTURE0); glBindTexture(GL_TEXTURE_2D, encoded.texture);
+            tracer.drawQuad();
+            source = &enlarged;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, output.fbo);
+        glViewport(0, 0, output.width, output.height);
+        glUseProgram(rcas_program);
+        glUniform1f(rcas_sharpness_loc, sharpness);
+        glActiveTexture(GL_TEXTURE0); glBindTexture(GL_TEXTURE_2D, source->texture);
+        tracer.drawQuad();
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        return output;
+    }
+    // Shows the last output in the window, stretched if the window is another size.
+    void present(int width, int height) const {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, output.fbo); glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glBlitFramebuffer(0, 0, output.width, output.height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+    void release() {
+        for (AccumulationTarget* t : {&encoded, &enlarged, &output}) if (t->fbo) t->release();
+        glDeleteProgram(easu_program); glDeleteProgram(rcas_program); easu_program = rcas_program = 0;
+    }
+};
+
+
+// --- Temporal Upsampling ---
+// With --upscale taau the viewer traces one sample per pixel per frame at render resolution,
+// each frame's camera rays offset by the next point of the Halton (2, 3) sequence. resolve()
+// folds the frame into a history at the output resolution, so over a few frames each output
+// pixel gathers samples from all over its area. Ray costs are those of the render resolution.
+// The history starts over after scene edits and quality changes; camera moves are reprojected.
+struct TemporalUpsampler {
+    GLuint program = 0, positions = 0;
+    GLint jitter_loc = -1, view_loc = -1, prev_view_loc = -1, camera_position_loc = -1, history_valid_loc = -1, camera_moved_loc = -1;
+    AccumulationTarget history[2]; int current = 0; bool valid = false;
+    GLuint attached_fbo = 0; int attached_width = 0, attached_height = 0; // the input holding positions
+    glm::mat4 prev_view{1.0f};
+    void create(int width, int height) {
+        program = createShaderProgram(taauShaderSource.c_str());
+        glUseProgram(program);
+        glUniform1i(glGetUniformLocation(program, "u_input"), 0); glUniform1i(glGetUniformLocation(program, "u_positions"), 1); glUniform1i(glGetUniformLocation(program, "u_history"), 2);
+        jitter_loc = glGetUniformLocation(program, "u_jitter");
+        view_loc = glGetUniformLocation(program, "u_view"); prev_view_loc = glGetUniformLocation(program, "u_prev_view");
+        camera_position_loc = glGetUniformLocation(program, "u_camera_position");
+        history_valid_loc = glGetUniformLocation(program, "u_history_valid"); camera_moved_loc = glGetUniformLocation(program, "u_camera_moved");
+        for (AccumulationTarget& h : history) {
+            h.create(width, height);
+            glBindTexture(GL_TEXTURE_2D, h.texture);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR); glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE); glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        }
+    }
+    static float halton(uint32_t index, uint32_t base) {
+        float f = 1.0f, r = 0.0f;
+        for (; index > 0; index /= base) { f /= base; r += f * (index % base); }
+        return r;
+    }
+    // Offset of frame's camera rays from the pixel centres, in pixels.
+    static glm::vec2 jitter(uint32_t frame) { uint32_t i = frame % 1024 + 1; return {halton(i, 2) - 0.5f, halton(i, 3) - 0.5f}; }
+    // Gives input a second attachment for the primary hit points the path tracer writes;
+    // again whenever input has been recreated at another size.
+    void attach(const AccumulationTarget& input) {
+        if (attached_fbo == input.fbo && attached_width == input.width && attached_height == input.height) return;
+        if (positions) glDeleteTextures(1, &positions);
+        glGenTextures(1, &positions);
+        glBindTexture(GL_TEXTURE_2D, positions);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, input.width, input.height, 0, GL_RGBA, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST); glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, input.fbo);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, positions, 0);
+        const GLenum buffers[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+        glDrawBuffers(2, buffers);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) throw std::runtime_error("Temporal upsampling framebuffer incomplete");
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        attached_fbo = input.fbo; attached_width = input.width; attached_height = input.height;
+    }
+    void reset() { valid = false; }
+    // Folds input, this frame's samples taken with jitter from camera, into the history.
+    const AccumulationTarget& resolve(const PathTracer& tracer, const AccumulationTarget& input, const Camera& camera, glm::vec2 jitter) {
+        glm::mat4 view = camera.view();
+        const AccumulationTarget& previous = history[current];
+        current ^= 1;
+        glBindFramebuffer(GL_FRAMEBUFFER, history[current].fbo);
+        glViewport(0, 0, history[current].width, history[current].height);
+        glUseProgram(program);
+        glUniform2f(jitter_loc, jitter.x, jitter.y);
+        glUniformMatrix4fv(view_loc, 1, GL_FALSE, glm::value_ptr(view)); glUniformMatrix4fv(prev_view_loc, 1, GL_FALSE, glm::value_ptr(prev_view));
+        glUniform3f(camera_position_loc, camera.position.x, camera.position.y, camera.position.z);
+        glUniform1i(history_valid_loc, valid ? 1 : 0); glUniform1i(camera_moved_loc, view != prev_view ? 1 : 0);
+        glActiveTexture(GL_TEXTURE0); glBindTexture(GL_TEXTURE_2D, input.texture);
+        glActiveTexture(GL_TEXTURE1); glBindTexture(GL_TEXTURE_2D, positions);
+        glActiveTexture(GL_TEXTURE2); glBindTexture(GL_TEXTURE_2D, previous.texture);
+        tracer.drawQuad();
+        glActiveTexture(GL_TEXTURE0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        valid = true; prev_view = view;
+        return history[current];
+    }
+    const AccumulationTarget& output() const { return history[current]; }
+    void release() {
+        for (AccumulationTarget& h : history) if (h.fbo) h.release();
+        if (positions) glDeleteTextures(1, &positions);
+        glDeleteProgram(program); program = positions = 0;
+    }
+};
+
+
+// --- Convergence Stop ---
+// Tells the viewer when a still image is done: after target_spp samples, or once the noise
+// estimate drops below target_noise. The mean is stored at 4 samples and again whenever the
+// count has at least doubled since the last stored one; each store after the first also
+// estimates the noise from the RMS difference between the mean at N and the stored mean at
+// M <= N/2, relative to the mean. The first M samples being part of the N, the expected square
+// of that difference is the variance of the mean at N times N/M - 1, which is divided out.
+// Counts are tracked explicitly, so frames may add any number of samples.
+struct ConvergenceMonitor {
+    uint32_t target_spp = 0; double target_noise = 0.0; // 0: no target
+    std::vector<float> earlier_mean, mean, rgba; uint32_t earlier_spp = 0; double noise = INFINITY; // buffers kept across estimates
+    void reset() { earlier_spp = 0; noise = INFINITY; }
+    bool converged(const AccumulationTarget& accum, uint32_t spp) {
+        if (target_spp && spp >= target_spp) return true;
+        if (target_noise <= 0.0) return false;
+        if (spp >= std::max(4u, 2 * earlier_spp)) {
+            accum.readback(rgba); resolveAccumulation(rgba, mean);
+            if (earlier_spp && earlier_mean.size() == mean.size()) {
+                double diff = 0.0, sum = 0.0;
+                for (size_t i = 0; i < mean.size(); ++i) { diff += (double)(mean[i] - earlier_mean[i]) * (mean[i] - earlier_mean[i]); sum += mean[i]; }
+                double variance = diff / mean.size() / ((double)spp / earlier_spp - 1.0);
+                noise = sum > 0.0 ? std::sqrt(variance) / (sum / mean.size()) : 0.0;
+            }
+            earlier_mean.swap(mean); earlier_spp = spp;
+        }
+        return noise < target_noise;
+    }
+};
+
+
+// --- Thermal Governor ---
+// Phones and fanless laptops hold full clocks for a few minutes, then firmware lowers them
+// and frame times jump. With --governor the viewer paces its frames and keeps the device at
+// a load it can sustain. It steps down a ladder of quality levels (samples per frame, then
+// path depth, then resolution) when the hottest thermal zone is heading over its target,
+// the battery draws more than the power target, the clocks get capped or frames overrun
+// their budget. After a spell of headroom it steps back up. Sensors are read from sysfs
+// below a root directory, so a tree of plain files can stand in for a device.
+struct DeviceSensors {
+    double temperature = NAN; // hottest thermal zone, degrees C
+    double power = NAN;       // battery discharge, W
+    double clock_cap = 1.0;   // lowest ratio of allowed to hardware maximum frequency, over cpufreq policies and devfreq devices
+};
+
+// The sensor files are found once; read() then only opens and reads them, off the heap.
+class SysfsSensors {
+public:
+    explicit SysfsSensors(const std::string& root) : root(root) {
+        for (const auto& zone : children("class/thermal", "thermal_zone")) zones.push_back((zone / "temp").string());
+        for (const auto& policy : children("devices/system/cpu/cpufreq", "policy")) {
+            double limit = 0.0;
+            if (readNumber((policy / "cpuinfo_max_freq").string(), limit) && limit > 0.0) clocks.push_back({(policy / "scaling_max_freq").string(), limit});
+        }
+        for (const auto& device : children("class/devfreq", "")) {
+            std::ifstream in(device / "available_frequencies");
+            double limit = 0.0; for (double f; in >> f;) limit = std::max(limit, f);
+            if (limit > 0.0) clocks.push_back({(device / "max_freq").string(), limit});
+        }
+        for (const auto& supply : children("class/power_supply", ""))
+            if (readWord((supply / "type").string()) == "Battery") batteries.push_back({(supply / "status").string(), (supply / "power_now").string(), (supply / "current_now").string(), (supply / "voltage_now").string()});
+    }
+    DeviceSensors read() const {
+        DeviceSensors sensors;
+        double value;
+        for (const std::string& zone : zones)
+            if (readNumber(zone, value)) sensors.temperature = std::fmax(sensors.temperature, value / 1000.0);
+        for (const Clock& clock : clocks)
+            if (readNumber(clock.max_freq, value)) sensors.clock_cap = std::min(sensors.clock_cap, value / clock.limit);
+        for (const Battery& battery : batteries) {
+            if (!readWord(battery.status, "Discharging")) continue;
+            double current, voltage;
+            if (readNumber(battery.power_now, value)) sensors.power = (std::isnan(sensors.power) ? 0.0 : sensors.power) + value * 1e-6;
+            else if (readNumber(battery.current_now, current) && readNumber(battery.voltage_now, voltage)) sensors.power = (std::isnan(sensors.power) ? 0.0 : sensors.power) + std::fabs(current) * voltage * 1e-12;
+        }
+        return sensors;
+    }
+private:
+    struct Clock { std::string max_freq; double limit; };
+    struct Battery { std::string status, power_now, current_now, voltage_now; };
+    std::string root;
+    std::vector<std::string> zones; std::vector<Clock> clocks; std::vector<Battery> batteries;
+    std::vector<std::filesystem::path> children(const char* dir, const char* prefix) const {
+        std::vector<std::filesystem::path> paths; std::error_code ec;
+        for (std::filesystem::directory_iterator it(std::filesystem::path(root) / dir, ec), end; !ec && it != end; it.increment(ec))
+            if (it->path().filename().string().rfind(prefix, 0) == 0) paths.push_back(it->path());
+        return paths;
+    }
+    // Reads the start of a file into buffer, NUL-terminated.
+    static bool readFile(const std::string& path, char (&buffer)[64]) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        ssize_t n = ::read(fd, buffer, sizeof(buffer) - 1);
+        ::close(fd);
+        if (n <= 0) return false;
+        buffer[n] = 0;
+        return true;
+    }
+    static bool readNumber(const std::string& path, double& value) {
+        char buffer[64], *end;
+        if (!readFile(path, buffer)) return false;
+        value = std::strtod(buffer, &end);
+        return end != buffer;
+    }
+    // Compares the file's first word with word.
+    static bool readWord(const std::string& path, const char* word) {
+        char buffer[64];
+        if (!readFile(path, buffer)) return false;
+        size_t n = strlen(word);
+        return strncmp(buffer, word, n) == 0 && (buffer[n] == 0 || isspace((unsigned char)buffer[n]));
+    }
+    static std::string readWord(const std::string& path) { std::ifstream in(path); std::string word; in >> word; return word; }
+};
+
+struct QualityLevel { int spp, depth; float scale; };
+
+class QualityGovernor {
+public:
+    static constexpr double SENSOR_INTERVAL = 0.5, LOOKAHEAD = 10.0, HYSTERESIS = 5.0, STEP_DOWN_HOLD = 1.0, STEP_UP_HOLD = 5.0; // seconds, or degrees C for HYSTERESIS
+    QualityGovernor(const std::string& sysfs_root, double temp_target, double power_target, double frame_budget, int max_spp)
+        : sensors(sysfs_root), temp_target(temp_target), power_target(power_target), frame_budget(frame_budget) {
+        for (int spp = max_spp; spp > 1; spp /= 2) levels.push_back({spp, MAX_DEPTH, 1.0f});
+        for (QualityLevel level : {QualityLevel{1, MAX_DEPTH, 1.0f}, {1, 5, 1.0f}, {1, 5, 0.71f}, {1, 3, 0.71f}, {1, 3, 0.5f}}) levels.push_back(level);
+        last_read = last_change = std::chrono::steady_clock::now();
+        reading = sensors.read(); baseline_cap = reading.clock_cap;
+    }
+    const QualityLevel& level() const { return levels[current]; }
+    size_t step() const { return current; } // 0 is the top level
+    size_t steps() const { return levels.size(); }
+    int maxSpp() const { return levels.front().spp; }
+    // Takes the time the last frame took before pacing; every SENSOR_INTERVAL, reads the
+    // sensors and may move one level. Returns true when it did. The self-test passes its own
+    // clock, later than the construction time.
+    bool update(double frame_seconds, std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now()) {
+        frame_times[frame_count++ % FRAME_WINDOW] = frame_seconds;
+        double dt = std::chrono::duration<double>(now - last_read).count();
+        if (dt < SENSOR_INTERVAL) return false;
+        DeviceSensors next = sensors.read();
+        if (!std::isnan(next.temperature) && !std::isnan(reading.temperature)) temp_slope = 0.7 * temp_slope + 0.3 * (next.temperature - reading.temperature) / dt;
+        reading = next; last_read = now;
+
+        size_t window = std::min(frame_count, FRAME_WINDOW);
+        double times[FRAME_WINDOW];
+        std::copy(frame_times, frame_times + window, times);
+        std::nth_element(times, times + window / 2, times + window);
+        frame_time = times[window / 2];
+        bool measured = frame_count >= 8; // frames of the current level
+        double projected = reading.temperature + std::max(0.0, temp_slope) * LOOKAHEAD; // NaN without thermal zones: never hot
+        bool capped = reading.clock_cap < baseline_cap * 0.98; // capped since start; a user's permanent cap is the baseline
+        bool over = projected > temp_target || (power_target > 0.0 && reading.power > power_target) || capped || (measured && frame_time > frame_budget);
+        bool headroom = !(projected > temp_target - HYSTERESIS) && !(power_target > 0.0 && reading.power > 0.85 * power_target) && !capped && measured && frame_time < 0.5 * frame_budget;
+        double held = std::chrono::duration<double>(now - last_change).count();
+        size_t previous = current;
+        if (over && held >= STEP_DOWN_HOLD && current + 1 < levels.size()) ++current;
+        else if (!over && headroom && held >= STEP_UP_HOLD && current > 0) --current;
+        if (current == previous) return false;
+        last_change = now; frame_count = 0;
+        const QualityLevel& l = levels[current];
+        std::cout << "Governor: level " << current << " of " << levels.size() - 1 << " (" << l.spp << " spp, depth " << l.depth << ", scale " << std::fixed << std::setprecision(2) << l.scale << ") at";
+        if (!std::isnan(reading.temperature)) std::cout << " " << std::setprecision(1) << reading.temperature << " C (" << std::showpos << temp_slope << std::noshowpos << " C/s),";
+        if (!std::isnan(reading.power)) std::cout << " " << std::setprecision(2) << reading.power << " W,";
+        std::cout << " clock cap " << std::setprecision(0) << reading.clock_cap * 100.0 << "%, frame " << std::setprecision(1) << frame_time * 1000.0 << " ms" << std::defaultfloat << std::setprecision(6) << std::endl;
+        return true;
+    }
+private:
+    SysfsSensors sensors;
+    double temp_target, power_target, frame_budget;
+    std::vector<QualityLevel> levels; size_t current = 0;
+    DeviceSensors reading; double baseline_cap = 1.0, temp_slope = 0.0, frame_time = 0.0; // temp_slope: smoothed, C/s
+    static constexpr size_t FRAME_WINDOW = 32;
+    double frame_times[FRAME_WINDOW]; size_t frame_count = 0; // the last FRAME_WINDOW of them, in a ring
+    std::chrono::steady_clock::time_point last_read, last_change;
+};
+
+
+// --- Interactive Viewer ---
+int runInteractive(const Options& opts, SDL_Window* window, PathTracer& tracer) {
+    std::unique_ptr<FramePlayer> player;
+    std::unique_ptr<FrameRecorder> recorder;
+    std::string scene_name = opts.scenes.front();
+    if (!opts.replay_file.empty()) { player.reset(new FramePlayer(opts.replay_file)); scene_name = player->scene_name; tracer.seed = player->seed; }
+    const BenchmarkScene* bench = findBenchmarkScene(scene_name);
+    if (!bench) throw std::runtime_error("Unknown scene in recording: " + scene_name);
+    if (!opts.record_file.empty()) recorder.reset(new FrameRecorder(opts.record_file, scene_name, tracer.seed));
+
+    // --- Scene Creation (CPU) and Upload to SSBOs ---
+    Scene scene;
+    bench->build(scene);
+    SceneBuffers buffers;
+    buffers.upload(scene);
+
+    AccumulationTarget accum;
+    accum.create(opts.width, opts.height);
+
+    // With --publish, each frame is also tone-mapped into an RGBA8 target and read back
+    // asynchronously; a frame is published once its copy has landed, a frame or two later.
+    std::unique_ptr<FramePublisher> publisher;
+    AccumulationTarget encoded; AsyncReadback frame_readback;
+    uint32_t accumulated = 0, readback_samples = 0; float readback_time = 0.0f;
+    if (!opts.publish_ring.empty()) {
+        publisher.reset(new FramePublisher(opts.publish_ring, opts.width, opts.height, opts.ring_slots));
+        encoded.create(opts.width, opts.height, 0, GL_RGBA8);
+    }
+
+    // With --render-scale, every target traced into is that fraction of --size.
+    const int render_width = std::max(1, (int)std::lround(opts.width * opts.render_scale)), render_height = std::max(1, (int)std::lround(opts.height * opts.render_scale));
+    std::unique_ptr<Upscaler> upscaler;
+    if (opts.upscale == UPSCALE_TAAU || (opts.upscale == UPSCALE_EASU && (opts.render_scale < 1.0f || opts.governor))) { upscaler.reset(new Upscaler()); upscaler->create(opts.width, opts.height, opts.sharpness); }
+    // With temporal upsampling accum only holds the current frame, and the image is the history.
+    std::unique_ptr<TemporalUpsampler> taau;
+    if (opts.upscale == UPSCALE_TAAU) { taau.reset(new TemporalUpsampler()); taau->create(opts.width, opts.height); }
+    auto image = [&]() -> const AccumulationTarget& { return taau ? taau->output() : accum; };
+    // The frame for the window; with the upscaler it is also what --publish reads back.
+    auto present = [&](const AccumulationTarget& image) -> const AccumulationTarget& {
+        if (!upscaler) { tracer.display(image, SCREEN_WIDTH, SCREEN_HEIGHT); return image; }
+        const AccumulationTarget& output = upscaler->render(tracer, image);
+        upscaler->present(SCREEN_WIDTH, SCREEN_HEIGHT);
+        return output;
+    };
+
+    RefinementPreview preview;
+    if (opts.refine) preview.create(render_width, render_height);
+    AccumulationTarget moving; // a single preview-mode sample while the camera or scene changes
+    if (opts.preview != PREVIEW_NONE) {
+        moving.create(render_width, render_height);
+        glBindTexture(GL_TEXTURE_2D, moving.texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR); glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    }
+
+    OrbitController orbit;
+    SceneEditor editor;
+    Camera last_camera{glm::vec3(NAN), glm::vec3(NAN)};
+    ConvergenceMonitor monitor;
+    monitor.target_spp = opts.target_spp; monitor.target_noise = opts.target_noise;
+    // With --governor or --render-scale, accum may be smaller than --size; the upscaler or
+    // display() enlarges it. Every level change restarts accumulation, as the estimate
+    // depends on the depth.
+    std::unique_ptr<QualityGovernor> governor;
+    if (opts.governor) governor.reset(new QualityGovernor(opts.sysfs_root, opts.temp_target, opts.power_target, 1.0 / opts.max_fps, opts.governor_spp));
+    const uint32_t sample_stride = governor ? governor->maxSpp() : 1; // frame f renders sample indices f * stride onwards
+    auto applyQuality = [&](const QualityLevel& level) {
+        tracer.max_depth = level.depth;
+        int width = std::max(1, (int)std::lround(render_width * level.scale)), height = std::max(1, (int)std::lround(render_height * level.scale));
+        if (width != accum.width || height != accum.height) {
+            accum.release(); accum.create(width, height);
+            glBindTexture(GL_TEXTURE_2D, accum.texture);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR); glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE); glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        }
+        accum.clear(); accumulated = 0; monitor.reset();
+        if (taau) taau->reset();
+    };
+    if (governor) applyQuality(governor->level());
+    else if (opts.render_scale < 1.0f) applyQuality({1, 0, 1.0f});
+    if (opts.swap_interval != INT_MIN && SDL_GL_SetSwapInterval(opts.swap_interval) != 0) std::cerr << "Swap interval " << opts.swap_interval << " not supported: " << SDL_GetError() << "\n";
+
+    // --- Main Loop ---
+    // Renders while the image changes or is still converging; once a still image has
+    // converged, blocks until the next event instead of rendering more samples.
+    bool quit = false, idle = false;
+    SDL_Event e;
+    auto startTime = std::chrono::high_resolution_clock::now();
+    float last_time = 0.0f;
+    double idle_seconds = 0.0; // spent blocked, kept off the orbit clock
+    // Frame-local data lives in this thread's arena, which is reset at the top of each frame.
+    // A frame is steady after WARMUP_FRAMES rendered frames if it had no input, edits or
+    // quality change; steady frames should not touch the heap at all.
+    const uint32_t WARMUP_FRAMES = 8;
+    uint32_t rendered = 0, steady_frames = 0; uint64_t steady_allocations = 0, worst_steady = 0, other_allocations = 0;
+
+    for (uint32_t frame = 0; !quit; ++frame) {
+        threadArena().reset();
+        uint64_t allocations_before = t_heap_allocations;
+        FrameRecord record;
+        auto handleEvent = [&](const SDL_Event& event) {
+            if (event.type == SDL_QUIT || (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_ESCAPE)) quit = true;
+            else if (!player && (event.type == SDL_KEYDOWN || event.type == SDL_KEYUP)) {
+                record.inputs.push_back({event.type, event.key.keysym.sym});
+                SceneEdit edit;
+                if (event.type == SDL_KEYDOWN && !orbit.handleKey(event.key.keysym.sym) && editor.handleKey(event.key.keysym.sym, scene, edit)) record.edits.push_back(edit);
+            }
+        };
+        if (idle) {
+            auto wait_start = std::chrono::high_resolution_clock::now();
+            if (SDL_WaitEvent(&e)) handleEvent(e);
+            idle_seconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - wait_start).count();
+        }
+        auto frame_start = std::chrono::high_resolution_clock::now();
+        while (SDL_PollEvent(&e) != 0) handleEvent(e);
+        if (quit) break;
+        if (idle && record.inputs.empty()) {
+            // Woken by something other than input (an expose, say): show the image again.
+            present(image());
+            SDL_GL_SwapWindow(window);
+            continue;
+        }
+
+        if (player) {
+            if (!player->read(record)) break;
+        } else {
+            auto currentTime = std::chrono::high_resolution_clock::now();
+            record.frame = frame;
+            record.time = (float)(std::chrono::duration<double>(currentTime - startTime).count() - idle_seconds);
+            orbit.update(record.time - last_time);
+            record.camera = orbit.camera();
+            last_time = record.time;
+        }
+        if (recorder) recorder->write(record);
+
+        // Accumulate while nothing changes; any camera move or edit restarts convergence.
+        for (const SceneEdit& edit : record.edits) applySceneEdit(scene, edit);
+        if (!record.edits.empty()) { buffers.upload(scene); if (taau) taau->reset(); }
+        // Frames that change something show the preview mode; refinement and accumulation
+        // start with the first still one.
+        bool changed = !record.edits.empty() || record.camera.position != last_camera.position || record.camera.target != last_camera.target;
+        if (changed) { accum.clear(); accumulated = 0; monitor.reset(); if (opts.refine) preview.restart(); }
+        last_camera = record.camera;
+        const AccumulationTarget* shown = &image();
+        if (changed && opts.preview != PREVIEW_NONE) { moving.clear(); tracer.renderPreview(moving, record.camera, record.frame, opts.preview); shown = &moving; }
+        else if (preview.active()) shown = &preview.render(tracer, record.camera, record.frame);
+        else {
+            int spp = governor ? governor->level().spp : 1;
+            if (taau) { taau->attach(accum); accum.clear(); tracer.jitter = TemporalUpsampler::jitter(record.frame); }
+            for (int s = 0; s < spp; ++s) tracer.renderSample(accum, record.camera, record.frame * sample_stride + s);
+            if (taau) { shown = &taau->resolve(tracer, accum, record.camera, tracer.jitter); tracer.jitter = glm::vec2(0.0f); }
+            accumulated += spp;
+        }
+
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        const AccumulationTarget& presented = present(*shown);
+
+        if (publisher) {
+            if (const void* pixels = frame_readback.map()) { publisher->publish(pixels, readback_samples, readback_time); frame_readback.unmap(); }
+            if (!frame_readback.pending()) {
+                if (upscaler) frame_readback.start(presented, GL_UNSIGNED_BYTE);
+                else { tracer.display(*shown, encoded.width, encoded.height, encoded.fbo); frame_readback.start(encoded, GL_UNSIGNED_BYTE); }
+                readback_samples = accumulated; readback_time = record.time;
+            }
+        }
+
+        SDL_GL_SwapWindow(window);
+        bool requality = governor && governor->update(std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - frame_start).count());
+        if (requality) applyQuality(governor->level());
+        if (opts.max_fps > 0.0) std::this_thread::sleep_until(frame_start + std::chrono::duration<double>(1.0 / opts.max_fps));
+        uint64_t allocations = t_heap_allocations - allocations_before;
+        if (++rendered > WARMUP_FRAMES && record.inputs.empty() && record.edits.empty() && !requality) { ++steady_frames; steady_allocations += allocations; worst_steady = std::max(worst_steady, allocations); }
+        else other_allocations += allocations;
+        // An orbiting camera never converges; a replay keeps to its recording.
+        idle = !player && !orbit.auto_orbit && shown == &image() && monitor.converged(image(), accumulated);
+    }
+
+    if (player) {
+        // Identical recordings on the same GPU and driver must print the same hash.
+        std::vector<float> rgba = image().readback();
+        std::cout << "Replay finished; accumulation hash " << std::hex << hashBytes(rgba.data(), rgba.size() * sizeof(float)) << std::dec << "\n";
+    }
+    if (opts.alloc_stats) {
+        if (steady_allocations > 0) std::cerr << "Steady-state frames allocated from the heap " << steady_allocations << " times\n";
+        const FrameArena::Stats& arena = threadArena().statistics();
+        std::cout << "Heap allocations: " << steady_allocations << " in " << steady_frames << " steady frames (at most " << worst_steady << " in one), "
+                  << other_allocations << " in " << rendered - steady_frames << " warm-up and changing frames; " << g_heap_allocations.load() << " by the process in all\n"
+                  << "Frame arena: " << arena.allocations << " allocations over " << arena.resets << " frames, peak " << arena.peak_bytes << " bytes in a frame, "
+                  << arena.capacity << " bytes reserved in " << arena.chunk_allocations << " heap allocations\n";
+    }
+
+    // Cleanup
+    frame_readback.release(); encoded.release();
+    if (moving.fbo) moving.release();
+    if (upscaler) upscaler->release();
+    if (taau) taau->release();
+    preview.release(); accum.release(); buffers.release();
+    // Only a replay is a reproducible check; an interactive session just reports.
+    return player && opts.alloc_stats && steady_allocations > 0 ? 1 : 0;
+}
+
+
+// --- Self Test ---
+// Headless checks for CI, in a hidden window like the other batch modes. Each prints one line;
+// --self-test exits 1 if any failed.
+struct SelfTest {
+    int failures = 0;
+    void check(bool ok, const std::string& what) { std::cout << (ok ? "ok      " : "FAILED  ") << what << std::endl; failures += !ok; }
+};
+
+// Drives a QualityGovernor over a sysfs tree of plain files in a temporary directory, with a
+// simulated 60 Hz clock: heat, battery drain and a clock cap must each step it down, and a
+// cool, idle device must bring it back to the top level.
+void selfTestGovernor(SelfTest& test) {
+    namespace fs = std::filesystem;
+    fs::path root = fs::temp_directory_path() / ("hrt-self-test-" + std::to_string(::getpid()));
+    auto write = [&](const std::string& file, const std::string& value) {
+        fs::create_directories((root / file).parent_path());
+        std::ofstream out(root / file, std::ios::trunc); out << value << "\n";
+        if (!out) throw std::runtime_error("Cannot write " + (root / file).string());
+    };
+    write("class/thermal/thermal_zone0/temp", "40000");
+    write("class/power_supply/BAT0/type", "Battery");
+    write("class/power_supply/BAT0/status", "Discharging");
+    write("class/power_supply/BAT0/power_now", "2000000");
+    write("devices/system/cpu/cpufreq/policy0/cpuinfo_max_freq", "2000000");
+    write("devices/system/cpu/cpufreq/policy0/scaling_max_freq", "2000000");
+
+    QualityGovernor governor(root.string(), 75.0, 5.0, 1.0 / 30.0, 4);
+    auto now = std::chrono::steady_clock::now();
+    // Frames of 5 ms, well inside the budget, so only the sensors move the governor.
+    auto run = [&](double seconds) {
+        for (int frame = 0; frame < (int)(seconds * 60.0); ++frame) { now += std::chrono::microseconds(16667); governor.update(0.005, now); }
+        return governor.step();
+    };
+    test.check(run(3.0) == 0, "governor: stays at the top level on a cool device");
+    struct Stress { const char* name; const char* file; const char* high; const char* normal; };
+    for (const Stress& stress : {Stress{"thermal zone at 90 C", "class/thermal/thermal_zone0/temp", "90000", "40000"},
+                                 Stress{"battery drawing 8 W", "class/power_supply/BAT0/power_now", "8000000", "2000000"},
+                                 Stress{"clocks capped at half", "devices/system/cpu/cpufreq/policy0/scaling_max_freq", "1000000", "2000000"}}) {
+        write(stress.file, stress.high);
+        size_t lowered = run(3.0);
+        test.check(lowered >= 2, std::string("governor: steps down with the ") + stress.name + " (level " + std::to_string(lowered) + ")");
+        write(stress.file, stress.normal);
+        test.check(run(5.0 * governor.steps() + 5.0) == 0, std::string("governor: back at the top level after the ") + stress.name);
+    }
+    std::error_code ec; fs::remove_all(root, ec);
+}
+
+// First laps a reader by hand: a frame seen complete must read as overwritten once the slot
+// was reused. Then publishes frames whose every byte is the frame number's low byte, as fast
+// as it can, while two readers copy the newest frame; every copy the seqlock accepts must
+// hold one whole frame.
+void selfTestFrameRing(SelfTest& test) {
+    const std::string name = "hrt-self-test-" + std::to_string(::getpid());
+    FramePublisher publisher(name, 128, 128, 3);
+    int fd = shm_open(shmName(name).c_str(), O_RDONLY, 0); struct stat st{};
+    if (fd < 0 || fstat(fd, &st) != 0) throw std::runtime_error("Cannot open shared memory " + shmName(name) + ": " + strerror(errno));
+    const uint8_t* base = (const uint8_t*)mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) throw std::runtime_error("Cannot map shared memory " + shmName(name) + ": " + strerror(errno));
+    FrameRingView ring(base);
+
+    std::vector<uint8_t> frame(ring.frameBytes());
+    auto publish = [&](uint32_t n) { std::fill(frame.begin(), frame.end(), (uint8_t)n); publisher.publish(frame.data(), n, 0.0f); };
+    publish(1);
+    bool seen = ring.complete(1) && ring.unchanged(1);
+    for (uint32_t n = 2; n <= 4; ++n) publish(n);
+    test.check(seen && !ring.unchanged(1) && ring.complete(4), "frame ring: a frame reads as overwritten once the publisher has lapped it");
+
+    std::atomic<bool> done{false};
+    std::atomic<uint64_t> accepted{0}, torn{0}, mixed{0};
+    auto read = [&]() {
+        std::vector<uint8_t> copy(ring.frameBytes());
+        for (uint64_t seen = 0; !done.load(std::memory_order_relaxed);) {
+            uint64_t n = ring.header->latest.load(std::memory_order_acquire);
+            if (n == seen) continue;
+            if (!ring.complete(n)) { ++torn; continue; }
+            memcpy(copy.data(), ring.pixels(n), copy.size());
+            uint32_t samples = ring.slot(n).samples;
+            if (!ring.unchanged(n)) { ++torn; continue; }
+            seen = n; ++accepted;
+            if (samples != (uint32_t)n || std::any_of(copy.begin(), copy.end(), [&](uint8_t byte) { return byte != (uint8_t)n; })) ++mixed;
+        }
+    };
+    std::thread readers[2] = {std::thread(read), std::thread(read)};
+    for (uint32_t n = 5; n <= 20000; ++n) publish(n);
+    done = true;
+    for (std::thread& reader : readers) reader.join();
+    munmap((void*)base, st.st_size);
+    test.check(accepted > 0 && mixed == 0, "frame ring: " + std::to_string(accepted) + " frames read in place while the publisher lapped the readers, " +
+               std::to_string(torn) + " overwritten ones rejected, " + std::to_string(mixed) + " mixed");
+}
+
+// A pool of unpinned workers with uneven capacities. The largest share is made slow, so the
+// others run dry and steal from it; every index must still run exactly once. A throwing body
+// must reach the caller and leave the pool usable.
+void selfTestThreadPool(SelfTest& test) {
+    ThreadPool pool({{-1, 1.0f}, {-1, 0.5f}, {-1, 0.5f}, {-1, 0.25f}});
+    const size_t count = 4000, slow = (size_t)(count / 2.25); // worker 0's share
+    std::vector<std::atomic<int>> runs(count);
+    std::vector<std::thread::id> runner(count);
+    pool.parallelFor(count, 4, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            ++runs[i]; runner[i] = std::this_thread::get_id();
+            if (i < slow) std::this_thread::sleep_for(std::chrono::microseconds(20));
+        }
+    });
+    bool once = std::all_of(runs.begin(), runs.end(), [](const std::atomic<int>& n) { return n == 1; });
+    std::set<std::thread::id> thieves(runner.begin(), runner.begin() + slow);
+    test.check(once, "thread pool: every index of an uneven parallelFor runs exactly once");
+    test.check(thieves.size() > 1, "thread pool: " + std::to_string(thieves.size() - 1) + " idle workers stole from the slow share");
+
+    bool thrown = false;
+    try { pool.parallelFor(count, 4, [&](size_t begin, size_t end) { if (begin <= 1234 && 1234 < end) throw std::runtime_error("self-test"); }); }
+    catch (const std::runtime_error& e) { thrown = std::string(e.what()) == "self-test"; }
+    bool covered = true;
+    for (size_t n = 1; n <= 200; ++n) {
+        std::atomic<size_t> sum{0};
+        pool.parallelFor(n, 3, [&](size_t begin, size_t end) { for (size_t i = begin; i < end; ++i) sum += i + 1; });
+        covered = covered && sum == n * (n + 1) / 2;
+    }
+    test.check(thrown && covered, "thread pool: an exception reaches the caller, and later calls of 1 to 200 indices cover them all");
+}
+
+// Renders the lights scene with ReSTIR direct and GI lighting in every pixel order. The order
+// only changes which invocations run side by side, so the accumulations must match bit for bit.
+void selfTestTraversal(SelfTest& test, PathTracer& tracer) {
+    const BenchmarkScene& bench = *findBenchmarkScene("lights");
+    Scene scene; bench.build(scene);
+    tracer.enableReSTIR(); tracer.enableReSTIRGI();
+    auto render = [&](Traversal order) {
+        SceneBuffers buffers; buffers.upload(scene); // a new upload: no ReSTIR history carries over
+        AccumulationTarget target; target.create(160, 120); // 20x15 workgroups: partial curve blocks on both edges
+        tracer.traversal = order;
+        for (uint32_t sample = 0; sample < 4; ++sample) tracer.renderSample(target, bench.camera, sample);
+        std::vector<float> rgba = target.readback();
+        target.release(); buffers.release();
+        return rgba;
+    };
+    std::vector<float> scanline = render(TRAVERSAL_SCANLINE);
+    test.check(render(TRAVERSAL_MORTON) == scanline, "traversal: morton order gives the scanline ReSTIR accumulation bit for bit");
+    test.check(render(TRAVERSAL_HILBERT) == scanline, "traversal: hilbert order gives the scanline ReSTIR accumulation bit for bit");
+}
+
+int runSelfTest(PathTracer& tracer) {
+    SelfTest test;
+    selfTestGovernor(test);
+    selfTestFrameRing(test);
+    selfTestThreadPool(test);
+    selfTestTraversal(test, tracer);
+    std::cout << (test.failures ? std::to_string(test.failures) + " self-test check(s) failed" : std::string("All self-test checks passed")) << std::endl;
+    return test.failures ? 1 : 0;
+}
+
+
+// --- Main Program ---
+int main(int argc, char* argv[]) {
+    Options opts = parseOptions(argc, argv);
+    if (!opts.compare_files.empty()) return runBenchmarkComparison(opts);
+    if (!opts.merge_output.empty()) return runMerge(opts);
+    if (opts.render && opts.spawn > 0) return runLocalSpawn(opts);
+    if (!opts.submit_socket.empty()) return runSubmit(opts);
+    if (!opts.consume_ring.empty()) return runConsumer(opts);
+    if (SDL_Init(SDL_INIT_VIDEO) < 0) throw std::runtime_error("SDL Init Failed");
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 4);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+    Uint32 window_flags = SDL_WINDOW_OPENGL | (opts.self_test || opts.convergence || opts.benchmark || opts.render || opts.tiled_width || opts.batch() || !opts.serve_socket.empty() ? SDL_WINDOW_HIDDEN : 0);
+    SDL_Window* window = SDL_CreateWindow("Hybrid Ray Tracer - Step 3 (Photoreal)", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, SCREEN_WIDTH, SCREEN_HEIGHT, window_flags);
+    SDL_GLContext context = SDL_GL_CreateContext(window);
+    glewExperimental = GL_TRUE;
+    if (glewInit() != GLEW_OK) throw std::runtime_error("GLEW Init Failed");
+
+    // --- Creating Shader Programs and Fullscreen Quad ---
+    PathTracer tracer;
+    tracer.init();
+    if (opts.batch()) tracer.enableMultiView();
+    tracer.seed = opts.seed;
+    tracer.projection = opts.projection;
+    tracer.cache_cell_pixels = opts.cache_cell_pixels;
+    if (opts.radiance_cache) tracer.enableRadianceCache();
+    if (opts.direct == DIRECT_RESTIR) tracer.enableReSTIR();
+    else tracer.direct = opts.direct;
+    if (opts.restir_gi) tracer.enableReSTIRGI();
+    tracer.photon_count = opts.photon_count; tracer.photon_radius = opts.photon_radius; tracer.photon_alpha = opts.photon_alpha;
+    if (opts.caustics != CAUSTICS_PATH) tracer.enableCaustics(opts.caustics);
+    tracer.guide_cell_size = opts.guide_cell_size;
+    if (opts.guiding) tracer.enableGuiding();
+    tracer.traversal = opts.traversal;
+
+    int result = opts.self_test ? runSelfTest(tracer) : !opts.serve_socket.empty() ? runServer(opts, tracer) : opts.convergence ? runConvergenceBenchmark(opts, tracer) : opts.benchmark ? runFrameTimeBenchmark(opts, tracer) : opts.batch() ? runBatchRender(opts, tracer) : opts.tiled_width ? runTiledRender(opts, tracer) : opts.render ? runOfflineRender(opts, tracer) : runInteractive(opts, window, tracer);
+
+    // Cleanup
+    tracer.release();
+    SDL_GL_DeleteContext(context); SDL_DestroyWindow(window); SDL_Quit();
+
+    return result;
 }